@@ -1,41 +0,0 @@
-//
-// MIT License
-//
-// Copyright (c) 2021 - 2023 Krai Ltd
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy
-// of this software and associated documentation files (the "Software"), to deal
-// in the Software without restriction, including without limitation the rights
-// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-// copies of the Software, and to permit persons to whom the Software is
-// furnished to do so, subject to the following conditions:
-//
-// The above copyright notice and this permission notice shall be included in
-// all copies or substantial portions of the Software.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
-// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
-//
-
-#ifndef PACK_H
-#define PACK_H
-
-#include <algorithm>
-#include <map>
-#include <vector>
-
-#include "sample.h"
-
-typedef std::pair<int, std::vector<int>> Entry;
-typedef std::map<const int, std::vector<Entry>> Lookup;
-
-void pack(const std::vector<SizedSample> &samples, int max_seq_len,
-          int max_seq_per_pack,
-          std::vector<std::vector<SizedSample>> &packed_samples);
-
-#endif
@@ -28,6 +28,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <unordered_map>
+
 #include "config/benchmark_config.h"
 
 #include "loadgen.h"
@@ -37,33 +39,115 @@ typedef std::pair<mlperf::QuerySample, int> SizedSample;
 
 #include "kilt_impl.h"
 
-#include "pack.h"
+#include "plugins/bert-packing/packed_inputs.h"
+#include "plugins/bert-packing/packed_outputs.h"
+#include "plugins/bert-packing/packer.h"
 
 #define DEBUG(msg) std::cout << "DEBUG: " << msg << std::endl;
 
 namespace KRAI {
 
+// Diagonal blocks of a packed attention mask.
+struct MaskLayout {
+  int count;
+  int offsets[PACK_MAX_SEQ_PER_PACK];
+  int lengths[PACK_MAX_SEQ_PER_PACK];
+};
+
+class PackWorkspace {
+public:
+  PackWorkspace(int max_seq_len, int max_seq_per_pack)
+      : packer(max_seq_len, max_seq_per_pack) {}
+
+  Packer<SizedSample> packer;
+  std::vector<SizedSample> sized_samples;
+  std::vector<std::vector<SizedSample>> packed_samples;
+};
+
 template <typename TInputDataType, typename TOutputDataType>
 class BertModel : public IModel {
 public:
   BertModel(const IConfig *config) : _config(config) {
 
     distilbert = _config->model_cfg->getInputCount() == 3;
+
+    compact_mask =
+        static_cast<BertModelConfig *>(_config->model_cfg)->getModelVariant() ==
+        BertModelConfig::DISTILBERT_PACKED_COMPACT_MASK;
+
+    BertModelConfig *model_cfg =
+        static_cast<BertModelConfig *>(_config->model_cfg);
+
+    // packed BERT takes the sequence lengths of a pack as an input, so a
+    // pack cannot hold more sequences than that input has room for
+    max_seq_per_pack = model_cfg->getModelMaxSeqPerPack();
+    if (model_cfg->getModelVariant() == BertModelConfig::BERT_PACKED &&
+        max_seq_per_pack > model_cfg->getInputSize(1)) {
+      std::cerr << "KILT_MODEL_BERT_MAX_SEQ_PER_PACK " << max_seq_per_pack
+                << " clamped to " << model_cfg->getInputSize(1) << std::endl;
+      max_seq_per_pack = model_cfg->getInputSize(1);
+    }
+
+    if (model_cfg->getStreamingPacker()) {
+      int max_wait = model_cfg->getStreamingPackerMaxWait();
+      // by default a batch KILT gathered for its full wait can be held as
+      // long again, so packs stay open across batches
+      if (max_wait < 0)
+        max_wait = 2 * _config->server_cfg->getMaxWait();
+      stream_packer_max_wait = std::chrono::microseconds(max_wait);
+
+      stream_packer = new StreamingPacker<SizedSample>(
+          model_cfg->getModelSequenceLength(),
+          max_seq_per_pack, model_cfg->getStreamingPackerOpenPacks());
+    }
+  }
+
+  virtual ~BertModel() {
+
+    uint64_t total_samples = 0, total_packs = 0, total_tokens = 0;
+    for (int w = 0; w < pack_workspaces.size(); ++w) {
+      total_samples += pack_workspaces[w]->packer.getTotalSamples();
+      total_packs += pack_workspaces[w]->packer.getTotalPacks();
+      total_tokens += pack_workspaces[w]->packer.getTotalTokens();
+      delete pack_workspaces[w];
+    }
+
+    if (stream_packer != nullptr) {
+      total_samples += stream_packer->getTotalSamples();
+      total_packs += stream_packer->getTotalPacks();
+      total_tokens += stream_packer->getTotalTokens();
+      delete stream_packer;
+    }
+
+    if (total_packs) {
+      unsigned int packed_seq_len =
+          static_cast<BertModelConfig *>(_config->model_cfg)
+              ->getModelSequenceLength();
+      std::cout << "Packed " << total_samples << " samples into "
+                << total_packs << " packs ("
+                << (float)total_samples / total_packs
+                << " per pack), efficiency: "
+                << 100.0f * total_tokens / (total_packs * packed_seq_len)
+                << "%" << std::endl;
+    }
   }
 
   virtual void
-  preprocessSamples(IDataSource *data_source, const void *samples, void *handle,
+  preprocessSamples(IDataSource *data_source, const void *samples,
+                    std::chrono::steady_clock::time_point arrival, void *handle,
                     void (*callback)(void *handle, const void *samples)) {
 
-    std::vector<SizedSample> sm =
-        *(reinterpret_cast<const std::vector<SizedSample> *>(samples));
+    const std::vector<SizedSample> *in =
+        reinterpret_cast<const std::vector<SizedSample> *>(samples);
 
     unsigned int dataset_seq_len =
         static_cast<SquadDataSourceConfig *>(_config->datasource_cfg)
             ->getDataSourceSequenceLength();
-    unsigned int packed_seq_len =
-        static_cast<BertModelConfig *>(_config->model_cfg)
-            ->getModelSequenceLength();
+
+    PackWorkspace *ws = popPackWorkspace();
+
+    std::vector<SizedSample> &sm = ws->sized_samples;
+    sm.assign(in->begin(), in->end());
 
     // get the sizes of each of the inputs
     for (int s = 0; s < sm.size(); ++s) {
@@ -79,13 +163,57 @@ public:
       sm[s].second = sum;
     }
 
-    std::vector<std::vector<SizedSample>> packed_samples;
+    if (stream_packer != nullptr) {
+      std::unique_lock<std::mutex> lock(stream_packer_mtx);
+      // the wait is counted from arrival, so it includes the time KILT
+      // spent gathering the batch
+      stream_packer->add(sm, arrival + stream_packer_max_wait, handle,
+                         callback);
+      lock.unlock();
+
+      pushPackWorkspace(ws);
+      return;
+    }
+
+    int pack_count = ws->packer.pack(sm);
 
-    pack(sm, packed_seq_len, 3, packed_samples);
+    if (ws->packed_samples.size() < pack_count)
+      ws->packed_samples.resize(pack_count);
 
-    for (int ps = 0; ps < packed_samples.size(); ++ps) {
-      callback(handle, &packed_samples[ps]);
+    for (int ps = 0; ps < pack_count; ++ps) {
+      const Pack &p = ws->packer.getPack(ps);
+      std::vector<SizedSample> &packed = ws->packed_samples[ps];
+
+      packed.clear();
+      for (int m = 0; m < p.count; ++m)
+        packed.push_back(sm[p.members[m]]);
+
+      callback(handle, &packed);
     }
+
+    pushPackWorkspace(ws);
+  }
+
+  virtual void
+  flushSamples(IDataSource *data_source, void *handle,
+               void (*callback)(void *handle, const void *samples)) {
+
+    if (stream_packer == nullptr)
+      return;
+
+    std::unique_lock<std::mutex> lock(stream_packer_mtx);
+    stream_packer->flush(std::chrono::steady_clock::now(), handle, callback);
+  }
+
+  virtual void
+  flushAllSamples(IDataSource *data_source, void *handle,
+                  void (*callback)(void *handle, const void *samples)) {
+
+    if (stream_packer == nullptr)
+      return;
+
+    std::unique_lock<std::mutex> lock(stream_packer_mtx);
+    stream_packer->flushAll(handle, callback);
   }
 
   void configureWorkload(IDataSource *data_source, const void *samples,
@@ -99,7 +227,8 @@ public:
       configureWorkloadOrig(data_source, samples, in_ptrs);
     else if (bmv == BertModelConfig::BERT_PACKED)
       configureWorkloadPacked(data_source, samples, in_ptrs);
-    else // if (bmv == BertModelConfig::DISTILBERT_PACKED)
+    else // if (bmv == BertModelConfig::DISTILBERT_PACKED ||
+         //     bmv == BertModelConfig::DISTILBERT_PACKED_COMPACT_MASK)
       configureWorkloadDistilBERTPacked(data_source, samples, in_ptrs);
   }
 
@@ -118,10 +247,9 @@ public:
 
     packed_seq_len = 384;
 
-    // clear input buffers
-    memset(in_ptrs[0], 0, packed_seq_len * sizeof(TInputDataType));
-    memset(in_ptrs[1], 0, packed_seq_len * sizeof(TInputDataType));
-    memset(in_ptrs[2], 0, packed_seq_len * sizeof(TInputDataType));
+    TInputDataType *ids = static_cast<TInputDataType *>(in_ptrs[0]);
+    TInputDataType *mask = static_cast<TInputDataType *>(in_ptrs[1]);
+    TInputDataType *seg = static_cast<TInputDataType *>(in_ptrs[2]);
 
     TInputDataType *src0 = static_cast<TInputDataType *>(
         data_source->getSamplePtr((*sm)[0].first.index, 0));
@@ -132,11 +260,15 @@ public:
 
     TInputDataType sample_seq_len = (*sm)[0].second;
 
-    for (int m = 0; m < sample_seq_len; m++) {
-      static_cast<TInputDataType *>(in_ptrs[0])[m] = src0[m];
-      static_cast<TInputDataType *>(in_ptrs[1])[m] = src1[m];
-      static_cast<TInputDataType *>(in_ptrs[2])[m] = src2[m];
-    }
+    assemble_sequence<TInputDataType, TInputDataType>(
+        ids, seg, nullptr, 0, src0, src2, 0, sample_seq_len);
+    assemble_sequence<TInputDataType, TInputDataType>(
+        mask, nullptr, nullptr, 0, src1, nullptr, 0, sample_seq_len);
+
+    // only the padding past the sample needs clearing
+    clear_tail(ids, sample_seq_len, packed_seq_len);
+    clear_tail(mask, sample_seq_len, packed_seq_len);
+    clear_tail(seg, sample_seq_len, packed_seq_len);
   }
 
   void configureWorkloadPacked(IDataSource *data_source, const void *samples,
@@ -152,11 +284,10 @@ public:
         static_cast<BertModelConfig *>(_config->model_cfg)
             ->getModelSequenceLength();
 
-    // clear input buffers
-    memset(in_ptrs[0], 0, packed_seq_len * sizeof(TInputDataType));
-    memset(in_ptrs[1], 0, 8 * sizeof(TInputDataType));
-    memset(in_ptrs[2], 0, packed_seq_len * sizeof(TInputDataType));
-    memset(in_ptrs[3], 0, packed_seq_len * sizeof(TInputDataType));
+    TInputDataType *ids = static_cast<TInputDataType *>(in_ptrs[0]);
+    TInputDataType *lengths = static_cast<TInputDataType *>(in_ptrs[1]);
+    TInputDataType *seg = static_cast<TInputDataType *>(in_ptrs[2]);
+    TInputDataType *pos = static_cast<TInputDataType *>(in_ptrs[3]);
 
     unsigned int offset = 0;
 
@@ -169,15 +300,18 @@ public:
 
       TInputDataType sample_seq_len = (*sm)[s].second;
 
-      for (int m = 0; m < sample_seq_len; m++) {
-        static_cast<TInputDataType *>(in_ptrs[0])[offset] = src0[m];
-        static_cast<TInputDataType *>(in_ptrs[2])[offset] = src2[m];
-        static_cast<TInputDataType *>(in_ptrs[3])[offset] = m;
-        ++offset;
-      }
+      assemble_sequence<TInputDataType, TInputDataType>(
+          ids, seg, pos, offset, src0, src2, 0, sample_seq_len);
+      offset += sample_seq_len;
 
-      static_cast<TInputDataType *>(in_ptrs[1])[s] = sample_seq_len;
+      lengths[s] = sample_seq_len;
     }
+
+    // everything up to offset has just been written, clear the rest
+    clear_tail(ids, offset, packed_seq_len);
+    clear_tail(lengths, sm->size(), _config->model_cfg->getInputSize(1));
+    clear_tail(seg, offset, packed_seq_len);
+    clear_tail(pos, offset, packed_seq_len);
   }
 
   void configureWorkloadDistilBERTPacked(IDataSource *data_source,
@@ -194,11 +328,12 @@ public:
         static_cast<BertModelConfig *>(_config->model_cfg)
             ->getModelSequenceLength();
 
-    // clear input buffers
-    memset(in_ptrs[0], 0, packed_seq_len * sizeof(TInputDataType));
-    memset(in_ptrs[1], 0,
-           packed_seq_len * packed_seq_len * sizeof(TInputDataType));
-    memset(in_ptrs[2], 0, packed_seq_len * sizeof(TInputDataType));
+    TInputDataType *ids = static_cast<TInputDataType *>(in_ptrs[0]);
+    TInputDataType *mask = static_cast<TInputDataType *>(in_ptrs[1]);
+    TInputDataType *pos = static_cast<TInputDataType *>(in_ptrs[2]);
+
+    MaskLayout layout;
+    layout.count = sm->size();
 
     unsigned int offset = 0;
 
@@ -209,15 +344,24 @@ public:
 
       TInputDataType sample_seq_len = (*sm)[s].second;
 
-      apply_mask(static_cast<TInputDataType *>(in_ptrs[1]), sample_seq_len,
-                 offset);
+      layout.offsets[s] = offset;
+      layout.lengths[s] = sample_seq_len;
 
-      for (int m = 0; m < sample_seq_len; m++) {
-        static_cast<TInputDataType *>(in_ptrs[0])[offset] = src0[m];
-        static_cast<TInputDataType *>(in_ptrs[2])[offset] = m;
-        ++offset;
-      }
+      // compact masks hold the 1-based index of the sequence per token
+      assemble_sequence<TInputDataType, TInputDataType>(
+          ids, compact_mask ? mask : nullptr, pos, offset, src0, nullptr, s + 1,
+          sample_seq_len);
+      offset += sample_seq_len;
     }
+
+    // everything up to offset has just been written, clear the rest; the
+    // full mask is only updated where it changes
+    clear_tail(ids, offset, packed_seq_len);
+    clear_tail(pos, offset, packed_seq_len);
+    if (compact_mask)
+      clear_tail(mask, offset, packed_seq_len);
+    else
+      update_mask(mask, layout);
   }
 
   void postprocessResults(void *samples, std::vector<void *> &out_ptrs) {
@@ -231,11 +375,9 @@ public:
         static_cast<SquadDataSourceConfig *>(_config->datasource_cfg)
             ->getDataSourceSequenceLength();
 
-    std::vector<mlperf::QuerySampleResponse> responses;
-    responses.reserve(sm->size());
-
-    std::vector<std::vector<float>> results;
-    results.resize(sm->size());
+    // results must stay valid until QuerySamplesComplete returns
+    ResponseBuffer<mlperf::QuerySampleResponse> *rb = response_arena.acquire();
+    rb->prepare(sm->size(), seq_len * 2);
 
     int offset = 0;
 
@@ -243,23 +385,45 @@ public:
 
       TInputDataType sample_seq_len = (*sm)[i].second;
 
-      results[i].resize(seq_len * 2, -10000.0f);
+      float *result = rb->getResult(i);
       TOutputDataType *b0 = ((TOutputDataType *)out_ptrs[0]) + offset;
       TOutputDataType *b1 = ((TOutputDataType *)out_ptrs[1]) + offset;
-      for (int j = 0; j < sample_seq_len; ++j) {
-        results[i][j * 2] = *(b0 + j);
-        results[i][(j * 2) + 1] = *(b1 + j);
-      }
+      interleave_logits(result, b0, b1, sample_seq_len, seq_len * 2);
       offset += sample_seq_len;
 
-      responses.push_back({(*sm)[i].first.id, uintptr_t(&results[i][0]),
-                           sizeof(float) * results[i].size()});
+      rb->responses.push_back(
+          {(*sm)[i].first.id, uintptr_t(result), sizeof(float) * seq_len * 2});
     }
 
-    mlperf::QuerySamplesComplete(responses.data(), responses.size());
+    mlperf::QuerySamplesComplete(rb->responses.data(), rb->responses.size());
+
+    response_arena.release(rb);
   };
 
 private:
+  PackWorkspace *popPackWorkspace() {
+    pack_workspaces_mtx.lock();
+    PackWorkspace *tmp;
+    if (pack_workspaces_free.size() == 0) {
+      BertModelConfig *model_cfg =
+          static_cast<BertModelConfig *>(_config->model_cfg);
+      tmp = new PackWorkspace(model_cfg->getModelSequenceLength(),
+                              max_seq_per_pack);
+      pack_workspaces.push_back(tmp);
+    } else {
+      tmp = pack_workspaces_free.back();
+      pack_workspaces_free.pop_back();
+    }
+    pack_workspaces_mtx.unlock();
+    return tmp;
+  }
+
+  void pushPackWorkspace(PackWorkspace *ws) {
+    pack_workspaces_mtx.lock();
+    pack_workspaces_free.push_back(ws);
+    pack_workspaces_mtx.unlock();
+  }
+
   void apply_mask(TInputDataType *ptr, int seq_len, int offset) {
 
     unsigned int packed_seq_len =
@@ -281,11 +445,81 @@ private:
     }
   }
 
+  void clear_mask(TInputDataType *ptr, int seq_len, int offset) {
+
+    unsigned int packed_seq_len =
+        static_cast<BertModelConfig *>(_config->model_cfg)
+            ->getModelSequenceLength();
+
+    ptr += offset * packed_seq_len + offset;
+
+    for (int i = 0; i < seq_len; ++i)
+      memset(ptr + packed_seq_len * i, 0, seq_len * sizeof(TInputDataType));
+  }
+
+  // Rewrites only the diagonal blocks that differ from the mask last written
+  // to this buffer. Device buffers are reused across batches, so the rest of
+  // the mask is still zero from the previous pack.
+  void update_mask(TInputDataType *ptr, const MaskLayout &next) {
+
+    unsigned int packed_seq_len =
+        static_cast<BertModelConfig *>(_config->model_cfg)
+            ->getModelSequenceLength();
+
+    mask_layouts_mtx.lock();
+    auto it = mask_layouts.find(ptr);
+    bool first_use = (it == mask_layouts.end());
+    if (first_use)
+      it = mask_layouts.emplace(ptr, MaskLayout()).first;
+    MaskLayout &prev = it->second;
+    mask_layouts_mtx.unlock();
+
+    if (first_use) {
+      memset(ptr, 0, packed_seq_len * packed_seq_len * sizeof(TInputDataType));
+      prev.count = 0;
+    }
+
+    // clear all stale blocks before setting any, blocks of the two layouts
+    // can overlap
+    for (int b = 0; b < prev.count; ++b) {
+      if (b < next.count && prev.offsets[b] == next.offsets[b] &&
+          prev.lengths[b] == next.lengths[b])
+        continue;
+      clear_mask(ptr, prev.lengths[b], prev.offsets[b]);
+    }
+
+    for (int b = 0; b < next.count; ++b) {
+      if (b < prev.count && prev.offsets[b] == next.offsets[b] &&
+          prev.lengths[b] == next.lengths[b])
+        continue;
+      apply_mask(ptr, next.lengths[b], next.offsets[b]);
+    }
+
+    prev = next;
+  }
+
   std::atomic<int> sample_count = 0;
   std::atomic<int> sample_delta = 0;
   const IConfig *_config;
 
   bool distilbert;
+  bool compact_mask;
+
+  std::vector<PackWorkspace *> pack_workspaces;
+  std::vector<PackWorkspace *> pack_workspaces_free;
+  std::mutex pack_workspaces_mtx;
+
+  // last mask layout written to each device mask buffer
+  std::unordered_map<void *, MaskLayout> mask_layouts;
+  std::mutex mask_layouts_mtx;
+
+  ResponseArena<mlperf::QuerySampleResponse> response_arena;
+
+  int max_seq_per_pack;
+
+  StreamingPacker<SizedSample> *stream_packer = nullptr;
+  std::chrono::microseconds stream_packer_max_wait;
+  std::mutex stream_packer_mtx;
 };
 
 IModel *modelConstruct(IConfig *config) {
@@ -86,7 +86,12 @@ IDataSourceConfig *getDataSourceConfig() { return new SquadDataSourceConfig(); }
 class BertModelConfig : public IModelConfig {
 
 public:
-  enum BERT_MODEL_VARIANT { BERT_ORIG, BERT_PACKED, DISTILBERT_PACKED };
+  enum BERT_MODEL_VARIANT {
+    BERT_ORIG,
+    BERT_PACKED,
+    DISTILBERT_PACKED,
+    DISTILBERT_PACKED_COMPACT_MASK
+  };
 
   BertModelConfig() {
 
@@ -99,6 +104,8 @@ public:
       bert_model_variant = BERT_PACKED;
     else if (kilt_model_variant_string == "DISTILBERT_PACKED")
       bert_model_variant = DISTILBERT_PACKED;
+    else if (kilt_model_variant_string == "DISTILBERT_PACKED_COMPACT_MASK")
+      bert_model_variant = DISTILBERT_PACKED_COMPACT_MASK;
     else
       bert_model_variant = BERT_PACKED; // default to BERT PACKED
   }
@@ -109,6 +116,14 @@ public:
 
   int getModelSequenceLength() const { return model_packed_seq_len; }
 
+  int getModelMaxSeqPerPack() const { return model_max_seq_per_pack; }
+
+  bool getStreamingPacker() const { return streaming_packer; }
+  int getStreamingPackerMaxWait() const { return streaming_packer_max_wait; }
+  int getStreamingPackerOpenPacks() const {
+    return streaming_packer_open_packs;
+  }
+
 private:
   std::string qaic_skip_stage =
       alter_str(getconfig_c("KILT_DEVICE_QAIC_SKIP_STAGE"), std::string(""));
@@ -119,6 +134,21 @@ private:
   const int model_packed_seq_len =
       alter_str_i(getconfig_c("KILT_MODEL_BERT_SEQ_LENGTH"), 384);
 
+  const int model_max_seq_per_pack =
+      alter_str_i(getconfig_c("KILT_MODEL_BERT_MAX_SEQ_PER_PACK"), 3);
+
+  const bool streaming_packer =
+      getconfig_opt_b(std::string("KILT_MODEL_BERT_STREAMING_PACKER"), false);
+
+  // longest a sample may wait from reaching KILT until its pack is
+  // dispatched, batching included; -1 falls back to twice the KILT batching
+  // wait (KILT_MAX_WAIT_ABS)
+  const int streaming_packer_max_wait =
+      alter_str_i(getconfig_c("KILT_MODEL_BERT_STREAMING_PACKER_MAX_WAIT"), -1);
+
+  const int streaming_packer_open_packs = alter_str_i(
+      getconfig_c("KILT_MODEL_BERT_STREAMING_PACKER_OPEN_PACKS"), 16);
+
   BERT_MODEL_VARIANT bert_model_variant;
 };
 
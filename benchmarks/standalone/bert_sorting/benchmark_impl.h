@@ -39,6 +39,8 @@ typedef std::pair<mlperf::QuerySample, int> SizedSample;
 
 #include "kilt_impl.h"
 
+#include "plugins/bert-packing/packed_outputs.h"
+
 #define DEBUG(msg) std::cout << "DEBUG: " << msg << std::endl;
 
 namespace KRAI {
@@ -49,7 +51,8 @@ public:
   BertModel(const IConfig *config) : _config(config) {}
 
   virtual void
-  preprocessSamples(IDataSource *data_source, const void *samples, void *handle,
+  preprocessSamples(IDataSource *data_source, const void *samples,
+                    std::chrono::steady_clock::time_point arrival, void *handle,
                     void (*callback)(void *handle, const void *samples)) {
 
     std::vector<SizedSample> sm =
@@ -140,33 +143,38 @@ public:
 
   void postprocessResults(void *samples, std::vector<void *> &out_ptrs) {
 
-    std::vector<SizedSample> sm =
+    const std::vector<SizedSample> &sm =
         *(reinterpret_cast<std::vector<SizedSample> *>(samples));
     unsigned int num_samples = sm.size();
 
-    std::vector<mlperf::QuerySampleResponse> responses;
-    responses.reserve(num_samples);
+    // half precision outputs are converted from their raw bits
+    typedef typename std::conditional<std::is_same<TOutputDataType,
+                                                   __half>::value,
+                                      fp16_bits, TOutputDataType>::type TLogit;
 
-    std::vector<std::vector<float>> results;
-    results.resize(num_samples);
+    int max_seq_len = 0;
+    for (int i = 0; i < num_samples; ++i)
+      max_seq_len = std::max(max_seq_len, sm[i].second);
+
+    // results must stay valid until QuerySamplesComplete returns
+    ResponseBuffer<mlperf::QuerySampleResponse> *rb = response_arena.acquire();
+    rb->prepare(num_samples, max_seq_len * 2);
 
     auto bm_config = static_cast<BertModelConfig *>(_config->model_cfg);
     std::string engineSource = bm_config->getEngineSource();
 
     if (engineSource == "nvidia") {
-      TOutputDataType *outputData = static_cast<TOutputDataType *>(out_ptrs[0]);
+      const TLogit *outputData = static_cast<const TLogit *>(out_ptrs[0]);
       int offset = 0;
 
       for (int i = 0; i < num_samples; ++i) {
         int sample_seq_len = sm[i].second;
-        results[i].resize(sample_seq_len * 2, -10000.0f);
-        for (int j = 0; j < sample_seq_len * 2; ++j) {
-          results[i][j] = static_cast<float>(*(outputData + offset + j));
-        }
+        float *result = rb->getResult(i);
+        convert_logits(result, outputData + offset, sample_seq_len * 2);
         offset += sample_seq_len * 2;
 
-        responses.push_back({sm[i].first.id, uintptr_t(&results[i][0]),
-                             sizeof(float) * results[i].size()});
+        rb->responses.push_back({sm[i].first.id, uintptr_t(result),
+                                 sizeof(float) * sample_seq_len * 2});
       }
     } else if (engineSource == "trtexec") {
       int offset = 0;
@@ -175,21 +183,20 @@ public:
 
         int sample_seq_len = sm[i].second;
 
-        results[i].resize(sample_seq_len * 2, -10000.0f);
+        float *result = rb->getResult(i);
         float *b0 = (float *)(out_ptrs[0]) + offset;
         float *b1 = (float *)(out_ptrs[1]) + offset;
-        for (int j = 0; j < sample_seq_len; ++j) {
-          results[i][j * 2] = *(b0 + j);
-          results[i][(j * 2) + 1] = *(b1 + j);
-        }
+        interleave_logits(result, b0, b1, sample_seq_len, sample_seq_len * 2);
         offset += sample_seq_len;
 
-        responses.push_back({sm[i].first.id, uintptr_t(&results[i][0]),
-                             sizeof(float) * results[i].size()});
+        rb->responses.push_back({sm[i].first.id, uintptr_t(result),
+                                 sizeof(float) * sample_seq_len * 2});
       }
     }
 
-    mlperf::QuerySamplesComplete(responses.data(), responses.size());
+    mlperf::QuerySamplesComplete(rb->responses.data(), rb->responses.size());
+
+    response_arena.release(rb);
   };
 
 private:
@@ -215,6 +222,8 @@ private:
   }
 
   const IConfig *_config;
+
+  ResponseArena<mlperf::QuerySampleResponse> response_arena;
 };
 
 IModel *modelConstruct(IConfig *config) {
@@ -36,18 +36,20 @@
 #include "config/benchmark_config.h"
 
 #include "plugins/nms-abp/nms_abp.h"
+#include "plugins/postprocess-pool/postprocess_pool.h"
 
 #if defined(__amd64__) && defined(ENABLE_ZEN2)
 #include <cstdint>
 #include <immintrin.h>
 #endif
 
+// model used when neither KILT_MODEL_NMS_MODEL nor the priors tell
 #if defined(MODEL_R34)
-#define Model_Params R34_Params
+#define DEFAULT_NMS_MODEL NMS_MODEL_R34
 #elif defined(MODEL_RX50)
-#define Model_Params RX50_Params
+#define DEFAULT_NMS_MODEL NMS_MODEL_RX50
 #else
-#define Model_Params MV1_Params
+#define DEFAULT_NMS_MODEL NMS_MODEL_MV1
 #endif
 
 #define DEBUG(msg) std::cout << "DEBUG: " << msg << std::endl;
@@ -112,13 +114,11 @@ private:
 class WorkingBuffers {
 
 public:
-  WorkingBuffers(const IConfig *c) {
+  WorkingBuffers(const IConfig *c, int num_classes)
+      : nms_workspace(num_classes) {
     cfg = c;
-    for (int i = 0; i < cfg->model_cfg->getBatchSize(); ++i) {
-      nms_results.push_back(std::vector<std::vector<float>>(
-          0, std::vector<float>(NUM_COORDINATES + 2, 0)));
+    for (int i = 0; i < cfg->model_cfg->getBatchSize(); ++i)
       reformatted_results.push_back(new ResultData(c));
-    }
   }
 
   ~WorkingBuffers() {
@@ -126,18 +126,15 @@ public:
       delete reformatted_results[i];
   }
 
-  void reset() {
-    for (int i = 0; i < cfg->model_cfg->getBatchSize(); ++i)
-      nms_results[i].clear();
-  }
+  void reset() { nms_workspace.reset(); }
 
-  std::vector<std::vector<std::vector<float>>> nms_results;
+  NMSWorkspace nms_workspace;
   std::vector<ResultData *> reformatted_results;
   const IConfig *cfg;
 };
 
 template <typename TInputDataType, typename TOutput1DataType,
-          typename TOutput2DataType>
+          typename TOutput2DataType, typename TParams>
 class ObjectDetectionModel : public IModel {
 public:
   ObjectDetectionModel(const IConfig *config) : _config(config) {
@@ -147,8 +144,19 @@ public:
     model_cfg = static_cast<ModelConfig *>(_config->model_cfg);
 
     nms_abp_processor =
-        new NMS_ABP<TOutput1DataType, TOutput2DataType, Model_Params>(
-            model_cfg->getPriorsBinPath());
+        new NMS_ABP<TOutput1DataType, TOutput2DataType, TParams>(
+            model_cfg->getPriorsBinPath(), model_cfg->getPreNMSTopK());
+
+    if (model_cfg->getPostprocessAffinity().size())
+      postprocess_pool =
+          new PostprocessPool(model_cfg->getPostprocessAffinity());
+  }
+
+  ~ObjectDetectionModel() {
+    delete postprocess_pool;
+    for (int j = 0; j < jobs_list.size(); ++j)
+      delete jobs_list[j];
+    delete nms_abp_processor;
   }
 
   void configureWorkload(IDataSource *data_source, const void *samples,
@@ -179,26 +187,31 @@ public:
             reinterpret_cast<TInputDataType *>(in_ptrs[0]) + i * buf_size;
 
 #if defined(__amd64__) && defined(ENABLE_ZEN2)
-#if !defined(MODEL_R34) && !defined(MODEL_RX50)
-        __m128i *src = reinterpret_cast<__m128i *>(src_ptr);
-        __m128i *dest = reinterpret_cast<__m128i *>(dest_ptr);
-        int64_t vectors = buf_size / sizeof(*src);
-        for (; vectors > 0; vectors--, src++, dest++) {
-          const __m128i loaded = _mm_stream_load_si128(src);
-          _mm_stream_si128(dest, loaded);
-        }
-#else // MODEL_MV1
-        const __m256i *src = reinterpret_cast<const __m256i *>(src_ptr);
-        __m256i *dest = reinterpret_cast<__m256i *>(dest_ptr);
-        int64_t vectors = buf_size / sizeof(*src);
-        for (; vectors > 0; vectors--, src++, dest++) {
-          const __m256i loaded = _mm256_stream_load_si256(src);
-          _mm256_stream_si256(dest, loaded);
-        }
-#endif
-        unsigned rem = buf_size % sizeof(*src);
-        if (rem > 0) {
-          memcpy((uint8_t *)dest, (uint8_t *)src, rem);
+        // MV1 images are a multiple of 16 bytes only
+        if constexpr (TParams::MODEL == NMS_MODEL_MV1) {
+          __m128i *src = reinterpret_cast<__m128i *>(src_ptr);
+          __m128i *dest = reinterpret_cast<__m128i *>(dest_ptr);
+          int64_t vectors = buf_size / sizeof(*src);
+          for (; vectors > 0; vectors--, src++, dest++) {
+            const __m128i loaded = _mm_stream_load_si128(src);
+            _mm_stream_si128(dest, loaded);
+          }
+          unsigned rem = buf_size % sizeof(*src);
+          if (rem > 0) {
+            memcpy((uint8_t *)dest, (uint8_t *)src, rem);
+          }
+        } else {
+          const __m256i *src = reinterpret_cast<const __m256i *>(src_ptr);
+          __m256i *dest = reinterpret_cast<__m256i *>(dest_ptr);
+          int64_t vectors = buf_size / sizeof(*src);
+          for (; vectors > 0; vectors--, src++, dest++) {
+            const __m256i loaded = _mm256_stream_load_si256(src);
+            _mm256_stream_si256(dest, loaded);
+          }
+          unsigned rem = buf_size % sizeof(*src);
+          if (rem > 0) {
+            memcpy((uint8_t *)dest, (uint8_t *)src, rem);
+          }
         }
         _mm_sfence();
 #else
@@ -230,84 +243,13 @@ public:
       mlperf::QuerySamplesComplete(responses.data(), responses.size());
     } else {
 
-#if defined(MODEL_RX50)
-      std::vector<TOutput1DataType *> boxes_ptrs(modelParams.OUTPUT_LEVELS);
-      std::vector<TOutput2DataType *> classes_ptrs(modelParams.OUTPUT_LEVELS);
-      std::vector<uint64_t *> topk_ptrs(modelParams.OUTPUT_LEVELS);
-#else
-      TOutput1DataType *boxes_ptr =
-          (TOutput1DataType *)out_ptrs[modelParams.BOXES_INDEX];
-      TOutput2DataType *classes_ptr =
-          (TOutput2DataType *)out_ptrs[modelParams.CLASSES_INDEX];
-#endif
-
       WorkingBuffers *wbs = popWorkingBuffers();
 
       for (int i = 0; i < s->size(); i++) {
 
-        std::vector<std::vector<float>> &nms_res = wbs->nms_results[i];
         ResultData *next_result_ptr = wbs->reformatted_results[i];
-
-        if (model_cfg->disableNMS()) {
-          next_result_ptr->set_size(1 * 7);
-          next_result_ptr->data()[0] = (float)((*s)[i].index);
-        } else {
-#if defined(MODEL_RX50)
-          for (int g = 0; g < modelParams.OUTPUT_LEVELS; ++g) {
-            TOutput1DataType *boxes_ptr =
-                (TOutput1DataType *)out_ptrs[modelParams.BOXES_INDEX + g];
-            TOutput2DataType *classes_ptr =
-                (TOutput2DataType *)out_ptrs[modelParams.CLASSES_INDEX + g];
-            uint64_t *topk_ptr =
-                (uint64_t *)out_ptrs[modelParams.TOPK_INDEX + g];
-            // std::cout << boxes_ptr[0] << " " << classes_ptr[0] << " " <<
-            // topk_ptr << std::endl;
-
-            boxes_ptrs[g] =
-                boxes_ptr + i * modelParams.TOTAL_NUM_BOXES * NUM_COORDINATES;
-            classes_ptrs[g] = classes_ptr + i * modelParams.TOTAL_NUM_BOXES;
-            topk_ptrs[g] = topk_ptr + i * modelParams.TOTAL_NUM_BOXES;
-          }
-          nms_abp_processor->anchorBoxProcessing(
-              (const TOutput1DataType **)boxes_ptrs.data(),
-              (const TOutput2DataType **)classes_ptrs.data(),
-              (const uint64_t **)topk_ptrs.data(), std::ref(nms_res),
-              (float)((*s)[i].index));
-#else // Classes + Boxes only
-          TOutput1DataType *dataLoc =
-              boxes_ptr + i * modelParams.TOTAL_NUM_BOXES * NUM_COORDINATES;
-          TOutput2DataType *dataConf =
-              classes_ptr +
-              i * modelParams.TOTAL_NUM_BOXES * modelParams.NUM_CLASSES;
-          nms_abp_processor->anchorBoxProcessing(
-              dataLoc, dataConf, std::ref(nms_res), (float)((*s)[i].index));
-#endif
-
-          int num_elems = nms_res.size() < (model_cfg->getMaxDetections() + 1)
-                              ? nms_res.size()
-                              : (model_cfg->getMaxDetections() + 1);
-
-          // std::cout << "num_elems: " << num_elems << " " <<
-          // model_cfg->getMaxDetections()+1 << std::endl;
-
-          next_result_ptr->set_size(num_elems * 7);
-          float *buffer = next_result_ptr->data();
-
-          for (int j = 0; j < num_elems; j++) {
-            buffer[0] = nms_res[j][0];
-            buffer[1] = nms_res[j][1];
-            buffer[2] = nms_res[j][2];
-            buffer[3] = nms_res[j][3];
-            buffer[4] = nms_res[j][4];
-            buffer[5] = nms_res[j][5];
-            buffer[6] = nms_res[j][6];
-
-            // std::cout << buffer[0] << "," << buffer[1] << "," << buffer[2] <<
-            // "," << buffer[3] << "," << buffer[4] << "," << buffer[5] << ","
-            // << buffer[6] << std::endl;
-            buffer += 7;
-          }
-        }
+        postprocessImage((*s)[i], i, out_ptrs, wbs->nms_workspace,
+                         next_result_ptr);
         responses.push_back({(*s)[i].id, uintptr_t(next_result_ptr->data()),
                              next_result_ptr->size() * sizeof(float)});
       }
@@ -317,7 +259,125 @@ public:
     }
   }
 
+  // With a postprocessing pool the images of the batch are handed to it one
+  // task each and completed as they finish. The device gets its outputs
+  // back as soon as the last image has been through NMS.
+  void postprocessResultsAsync(void *samples, std::vector<void *> &out_ptrs,
+                               void *handle,
+                               void (*callback)(void *handle)) override {
+
+    std::vector<mlperf::QuerySample> *s =
+        reinterpret_cast<std::vector<mlperf::QuerySample> *>(samples);
+
+    if (postprocess_pool == nullptr || s->size() == 0 ||
+        model_cfg->getDeviceName() == "tensorrt") {
+      IModel::postprocessResultsAsync(samples, out_ptrs, handle, callback);
+      return;
+    }
+
+    PostprocessJob *job = popJob();
+    job->model = this;
+    job->samples = s;
+    job->out_ptrs = &out_ptrs;
+    job->handle = handle;
+    job->callback = callback;
+    job->remaining = s->size();
+
+    for (int i = 0; i < s->size(); i++)
+      postprocess_pool->submit(postprocessJobImage, job, i);
+  }
+
 private:
+  struct PostprocessJob {
+    ObjectDetectionModel *model;
+    std::vector<mlperf::QuerySample> *samples;
+    std::vector<void *> *out_ptrs;
+    void *handle;
+    void (*callback)(void *handle);
+    std::atomic<int> remaining;
+  };
+
+  static void postprocessJobImage(void *ctx, int i) {
+    PostprocessJob *job = static_cast<PostprocessJob *>(ctx);
+    ObjectDetectionModel *m = job->model;
+
+    // the samples belong to the device and go back with its outputs
+    mlperf::ResponseId id = (*job->samples)[i].id;
+
+    WorkingBuffers *wbs = m->popWorkingBuffers();
+    ResultData *result = wbs->reformatted_results[0];
+    m->postprocessImage((*job->samples)[i], i, *job->out_ptrs,
+                        wbs->nms_workspace, result);
+
+    if (--job->remaining == 0) {
+      void *handle = job->handle;
+      void (*callback)(void *handle) = job->callback;
+      m->pushJob(job);
+      callback(handle);
+    }
+
+    mlperf::QuerySampleResponse response = {
+        id, uintptr_t(result->data()), result->size() * sizeof(float)};
+    mlperf::QuerySamplesComplete(&response, 1);
+    m->pushWorkingBuffers(wbs);
+  }
+
+  // Runs NMS on image i of the batch in out_ptrs, leaving its detections in
+  // result.
+  void postprocessImage(const mlperf::QuerySample &sample, int i,
+                        std::vector<void *> &out_ptrs,
+                        NMSWorkspace &nms_workspace, ResultData *result) {
+
+    if (model_cfg->disableNMS()) {
+      result->set_size(1 * 7);
+      result->data()[0] = (float)(sample.index);
+      return;
+    }
+
+    if constexpr (TParams::MODEL == NMS_MODEL_RX50) {
+      const TOutput1DataType *boxes_ptrs[TParams::OUTPUT_LEVELS];
+      const TOutput2DataType *classes_ptrs[TParams::OUTPUT_LEVELS];
+      const uint64_t *topk_ptrs[TParams::OUTPUT_LEVELS];
+
+      for (int g = 0; g < TParams::OUTPUT_LEVELS; ++g) {
+        TOutput1DataType *boxes_ptr =
+            (TOutput1DataType *)out_ptrs[modelParams.BOXES_INDEX + g];
+        TOutput2DataType *classes_ptr =
+            (TOutput2DataType *)out_ptrs[modelParams.CLASSES_INDEX + g];
+        uint64_t *topk_ptr = (uint64_t *)out_ptrs[modelParams.TOPK_INDEX + g];
+
+        boxes_ptrs[g] =
+            boxes_ptr + i * modelParams.TOTAL_NUM_BOXES * NUM_COORDINATES;
+        classes_ptrs[g] = classes_ptr + i * modelParams.TOTAL_NUM_BOXES;
+        topk_ptrs[g] = topk_ptr + i * modelParams.TOTAL_NUM_BOXES;
+      }
+      nms_abp_processor->anchorBoxProcessing(boxes_ptrs, classes_ptrs,
+                                             topk_ptrs, nms_workspace,
+                                             (float)(sample.index));
+    } else { // Classes + Boxes only
+      TOutput1DataType *boxes_ptr =
+          (TOutput1DataType *)out_ptrs[modelParams.BOXES_INDEX];
+      TOutput2DataType *classes_ptr =
+          (TOutput2DataType *)out_ptrs[modelParams.CLASSES_INDEX];
+
+      TOutput1DataType *dataLoc =
+          boxes_ptr + i * modelParams.TOTAL_NUM_BOXES * NUM_COORDINATES;
+      TOutput2DataType *dataConf =
+          classes_ptr +
+          i * modelParams.TOTAL_NUM_BOXES * modelParams.NUM_CLASSES;
+      nms_abp_processor->anchorBoxProcessing(dataLoc, dataConf, nms_workspace,
+                                             (float)(sample.index));
+    }
+
+    std::vector<bbox> &nms_res = nms_workspace.selectedAll;
+    int num_elems = nms_res.size() < (model_cfg->getMaxDetections() + 1)
+                        ? nms_res.size()
+                        : (model_cfg->getMaxDetections() + 1);
+
+    result->set_size(num_elems * 7);
+    memcpy(result->data(), nms_res.data(), num_elems * sizeof(bbox));
+  }
+
   const IConfig *_config;
 
   ObjectDetectionDataSourceConfig *datasource_cfg;
@@ -327,14 +387,16 @@ private:
   // std::vector<std::vector<std::vector<float>>> *nms_results;
   // std::vector<ResultData*> *reformatted_results;
 
-  NMS_ABP<TOutput1DataType, TOutput2DataType, Model_Params> *nms_abp_processor;
-  Model_Params modelParams;
+  NMS_ABP<TOutput1DataType, TOutput2DataType, TParams> *nms_abp_processor;
+  TParams modelParams;
+
+  PostprocessPool *postprocess_pool = nullptr;
 
   WorkingBuffers *popWorkingBuffers() {
     working_buffs_mtx.lock();
     WorkingBuffers *tmp;
     if (working_buffers_list.size() == 0) {
-      tmp = new WorkingBuffers(_config);
+      tmp = new WorkingBuffers(_config, TParams::NUM_CLASSES);
     } else {
       tmp = working_buffers_list.back();
       working_buffers_list.pop_back();
@@ -358,22 +420,61 @@ private:
     return int8_value;
   }
 
+  PostprocessJob *popJob() {
+    jobs_mtx.lock();
+    PostprocessJob *tmp;
+    if (jobs_list.size() == 0) {
+      tmp = new PostprocessJob;
+    } else {
+      tmp = jobs_list.back();
+      jobs_list.pop_back();
+    }
+    jobs_mtx.unlock();
+    return tmp;
+  }
+
+  void pushJob(PostprocessJob *job) {
+    jobs_mtx.lock();
+    jobs_list.push_back(job);
+    jobs_mtx.unlock();
+  }
+
   std::vector<WorkingBuffers *> working_buffers_list;
   std::mutex working_buffs_mtx;
-};
 
-IModel *modelConstruct(IConfig *config) {
+  std::vector<PostprocessJob *> jobs_list;
+  std::mutex jobs_mtx;
+};
 
+template <typename TParams>
+IModel *modelConstructFor(IConfig *config) {
   if (config->model_cfg->getInputDatatype(0) == IModelConfig::IO_TYPE::FLOAT32)
-    return new ObjectDetectionModel<float, float, float>(config);
+    return new ObjectDetectionModel<float, float, float, TParams>(config);
   else
-#if defined(MODEL_R34)
-    return new ObjectDetectionModel<uint8_t, uint8_t, uint16_t>(config);
-#elif defined(MODEL_RX50)
-    return new ObjectDetectionModel<uint8_t, uint16_t, uint16_t>(config);
-#else // MODEL_MV1
-    return new ObjectDetectionModel<uint8_t, uint8_t, uint8_t>(config);
-#endif
+    return new ObjectDetectionModel<uint8_t, typename TParams::LocType,
+                                    typename TParams::ConfType, TParams>(
+        config);
+}
+
+IModel *modelConstruct(IConfig *config) {
+
+  ModelConfig *model_cfg = static_cast<ModelConfig *>(config->model_cfg);
+
+  NMSModel nms_model =
+      selectNMSModel(model_cfg->getNMSModelName(),
+                     model_cfg->getPriorsBinPath(), DEFAULT_NMS_MODEL);
+
+  switch (nms_model) {
+  case NMS_MODEL_R34:
+    std::cout << "NMS model: R34" << std::endl;
+    return modelConstructFor<R34_Params>(config);
+  case NMS_MODEL_RX50:
+    std::cout << "NMS model: RX50" << std::endl;
+    return modelConstructFor<RX50_Params>(config);
+  default:
+    std::cout << "NMS model: MV1" << std::endl;
+    return modelConstructFor<MV1_Params>(config);
+  }
 }
 
 template <typename TInputDataType>
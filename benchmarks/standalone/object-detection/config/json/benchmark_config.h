@@ -107,19 +107,45 @@ IDataSourceConfig *getDataSourceConfig() {
 
 class ModelConfig : public IModelConfig {
 public:
+  ModelConfig() {
+    // comma separated cpus, one postprocessing thread on each
+    std::stringstream ss(postprocess_affinity_str);
+    while (ss.good()) {
+      std::string substr;
+      std::getline(ss, substr, ',');
+      if (substr != "")
+        postprocess_affinity.push_back(std::stoi(substr));
+    }
+  }
+
   virtual ~ModelConfig(){};
 
   const int getMaxDetections() { return max_detections; }
   const bool disableNMS() { return disable_nms; }
   const std::string getPriorsBinPath() { return priors_bin_path; }
+  const int getPreNMSTopK() { return pre_nms_top_k; }
+  const std::string getNMSModelName() { return nms_model_name; }
+  const std::vector<int> &getPostprocessAffinity() {
+    return postprocess_affinity;
+  }
 
 private:
   const std::string priors_bin_path =
       getconfig_s("KILT_MODEL_NMS_PRIOR_BIN_PATH");
+  // MV1, R34 or RX50, found from the priors when not given
+  const std::string nms_model_name =
+      alter_str(getconfig_c("KILT_MODEL_NMS_MODEL"), std::string(""));
   const int max_detections = alter_str_i(
       getconfig_c("KILT_MODEL_NMS_MAX_DETECTIONS"),
       getconfig_c("CK_ENV_QAIC_MODEL_KILT_MODEL_NMS_MAX_DETECTIONS"));
   const bool disable_nms = (getconfig_c("KILT_MODEL_NMS_DISABLE") != NULL);
+  // candidates per class kept for NMS, 0 keeps all
+  const int pre_nms_top_k =
+      alter_str_i(getconfig_c("KILT_MODEL_NMS_PRE_TOP_K"), 0);
+
+  std::string postprocess_affinity_str = alter_str(
+      getconfig_c("KILT_MODEL_NMS_POSTPROCESS_AFFINITY"), std::string(""));
+  std::vector<int> postprocess_affinity;
 };
 
 IModelConfig *getModelConfig() { return new ModelConfig(); }
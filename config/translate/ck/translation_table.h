@@ -42,11 +42,21 @@ Translation translation_table[] = {
     // model BERT
     {"KILT_MODEL_BERT_SEQ_LENGTH", "ML_MODEL_SEQ_LENGTH"},
     {"KILT_MODEL_BERT_VARIANT", "KILT_MODEL_BERT_VARIANT"},
+    {"KILT_MODEL_BERT_MAX_SEQ_PER_PACK", "KILT_MODEL_BERT_MAX_SEQ_PER_PACK"},
+    {"KILT_MODEL_BERT_STREAMING_PACKER", "KILT_MODEL_BERT_STREAMING_PACKER"},
+    {"KILT_MODEL_BERT_STREAMING_PACKER_MAX_WAIT",
+     "KILT_MODEL_BERT_STREAMING_PACKER_MAX_WAIT"},
+    {"KILT_MODEL_BERT_STREAMING_PACKER_OPEN_PACKS",
+     "KILT_MODEL_BERT_STREAMING_PACKER_OPEN_PACKS"},
 
     // model Object Detection
     {"KILT_MODEL_NMS_PRIOR_BIN_PATH", "PRIOR_BIN_PATH"},
+    {"KILT_MODEL_NMS_MODEL", "CK_ENV_NMS_MODEL"},
     {"KILT_MODEL_NMS_MAX_DETECTIONS", "CK_ENV_QAIC_MODEL_MAX_DETECTIONS"},
     {"KILT_MODEL_NMS_DISABLE", "CK_ENV_DISABLE_NMS"},
+    {"KILT_MODEL_NMS_PRE_TOP_K", "CK_ENV_NMS_PRE_TOP_K"},
+    {"KILT_MODEL_NMS_POSTPROCESS_AFFINITY",
+     "CK_ENV_NMS_POSTPROCESS_AFFINITY"},
 
     // dataset SQUAD
     {"KILT_DATASET_SQUAD_TOKENIZED_MAX_SEQ_LENGTH",
@@ -90,9 +100,25 @@ Translation translation_table[] = {
     {"KILT_DEVICE_QAIC_SAMPLES_QUEUE_DEPTH",
      "KILT_DEVICE_QAIC_SAMPLES_QUEUE_DEPTH"},
     {"KILT_DEVICE_QAIC_RINGFENCE_DRIVER", "KILT_DEVICE_QAIC_RINGFENCE_DRIVER"},
-    {"KILT_DEVICE_QAIC_SCHEDULER_YIELD_TIME",
-     "KILT_DEVICE_SCHEDULER_YIELD_TIME"},
-    {"KILT_DEVICE_QAIC_ENQUEUE_YIELD_TIME", "KILT_DEVICE_ENQUEUE_YIELD_TIME"},
+    {"KILT_DEVICE_QAIC_ENQUEUE_THREADS", "KILT_DEVICE_ENQUEUE_THREADS"},
+    {"KILT_DEVICE_QAIC_ACTIVATION_POLICY", "CK_ENV_QAIC_ACTIVATION_POLICY"},
+    {"KILT_DEVICE_QAIC_EMULATED_LATENCY", "CK_ENV_QAIC_EMULATED_LATENCY"},
+    {"KILT_DEVICE_QAIC_EMULATED_CONCURRENCY",
+     "CK_ENV_QAIC_EMULATED_CONCURRENCY"},
+
+    // device onnxrt
+    {"KILT_DEVICE_ONNX_WORKERS", "CK_ENV_ONNX_WORKERS"},
+    {"KILT_DEVICE_ONNX_SAMPLES_QUEUE_DEPTH", "CK_ENV_ONNX_SAMPLES_QUEUE_DEPTH"},
+    {"KILT_DEVICE_ONNX_LOG_LEVEL", "CK_ENV_ONNX_LOG_LEVEL"},
+    {"KILT_DEVICE_ONNX_INTRA_OP_THREADS", "CK_ENV_ONNX_INTRA_OP_THREADS"},
+    {"KILT_DEVICE_ONNX_INTER_OP_THREADS", "CK_ENV_ONNX_INTER_OP_THREADS"},
+    {"KILT_DEVICE_ONNX_ALLOW_SPINNING", "CK_ENV_ONNX_ALLOW_SPINNING"},
+    {"KILT_DEVICE_ONNX_GRAPH_OPTIMIZATION", "CK_ENV_ONNX_GRAPH_OPTIMIZATION"},
+    {"KILT_DEVICE_ONNX_EXECUTION_MODE", "CK_ENV_ONNX_EXECUTION_MODE"},
+    {"KILT_DEVICE_ONNX_CPU_MEM_ARENA", "CK_ENV_ONNX_CPU_MEM_ARENA"},
+    {"KILT_DEVICE_ONNX_MEM_PATTERN", "CK_ENV_ONNX_MEM_PATTERN"},
+    {"KILT_DEVICE_ONNX_OPTIMIZED_MODEL_CACHE",
+     "CK_ENV_ONNX_OPTIMIZED_MODEL_CACHE"},
 
     // network
     {"KILT_NETWORK_SERVER_PORT", "NETWORK_SERVER_PORT"},
@@ -41,11 +41,21 @@ Translation translation_table[] = {
     // model BERT
     {"KILT_MODEL_BERT_SEQ_LENGTH", "kilt_model_seq_length"},
     {"KILT_MODEL_BERT_VARIANT", "kilt_model_bert_variant"},
+    {"KILT_MODEL_BERT_MAX_SEQ_PER_PACK", "kilt_model_bert_max_seq_per_pack"},
+    {"KILT_MODEL_BERT_STREAMING_PACKER", "kilt_model_bert_streaming_packer"},
+    {"KILT_MODEL_BERT_STREAMING_PACKER_MAX_WAIT",
+     "kilt_model_bert_streaming_packer_max_wait"},
+    {"KILT_MODEL_BERT_STREAMING_PACKER_OPEN_PACKS",
+     "kilt_model_bert_streaming_packer_open_packs"},
 
     // model Object Detection
     {"KILT_MODEL_NMS_PRIOR_BIN_PATH", "kilt_prior_bin_path"},
+    {"KILT_MODEL_NMS_MODEL", "kilt_model_nms_model"},
     {"KILT_MODEL_NMS_MAX_DETECTIONS", "kilt_model_max_detections"},
     {"KILT_MODEL_NMS_DISABLE", "kilt_model_disable_nms"},
+    {"KILT_MODEL_NMS_PRE_TOP_K", "kilt_model_nms_pre_top_k"},
+    {"KILT_MODEL_NMS_POSTPROCESS_AFFINITY",
+     "kilt_model_nms_postprocess_affinity"},
 
     // dataset SQUAD
     {"KILT_DATASET_SQUAD_TOKENIZED_MAX_SEQ_LENGTH",
@@ -87,9 +97,11 @@ Translation translation_table[] = {
     {"KILT_DEVICE_QAIC_INPUT_SELECT", "qaic_input_select"},
     {"KILT_DEVICE_QAIC_SAMPLES_QUEUE_DEPTH", "kilt_device_samples_queue_depth"},
     {"KILT_DEVICE_QAIC_RINGFENCE_DRIVER", "kilt_device_ringfence_driver"},
-    {"KILT_DEVICE_QAIC_SCHEDULER_YIELD_TIME",
-     "kilt_device_scheduler_yield_time"},
-    {"KILT_DEVICE_QAIC_ENQUEUE_YIELD_TIME", "kilt_device_enqueue_yield_time"},
+    {"KILT_DEVICE_QAIC_ENQUEUE_THREADS", "kilt_device_enqueue_threads"},
+    {"KILT_DEVICE_QAIC_ACTIVATION_POLICY", "kilt_device_activation_policy"},
+    {"KILT_DEVICE_QAIC_EMULATED_LATENCY", "kilt_device_emulated_latency"},
+    {"KILT_DEVICE_QAIC_EMULATED_CONCURRENCY",
+     "kilt_device_emulated_concurrency"},
 
     // device tensorrt
     {"KILT_DEVICE_TENSORRT_NUMBER_OF_STREAMS", "tensorrt_number_of_stream"},
@@ -104,6 +116,22 @@ Translation translation_table[] = {
     // device snpe AND device onnxrt
     {"KILT_BACKEND_TYPE", "kilt_backend_type"},
 
+    // device onnxrt
+    {"KILT_DEVICE_ONNX_WORKERS", "kilt_device_onnx_workers"},
+    {"KILT_DEVICE_ONNX_SAMPLES_QUEUE_DEPTH",
+     "kilt_device_onnx_samples_queue_depth"},
+    {"KILT_DEVICE_ONNX_LOG_LEVEL", "kilt_device_onnx_log_level"},
+    {"KILT_DEVICE_ONNX_INTRA_OP_THREADS", "kilt_device_onnx_intra_op_threads"},
+    {"KILT_DEVICE_ONNX_INTER_OP_THREADS", "kilt_device_onnx_inter_op_threads"},
+    {"KILT_DEVICE_ONNX_ALLOW_SPINNING", "kilt_device_onnx_allow_spinning"},
+    {"KILT_DEVICE_ONNX_GRAPH_OPTIMIZATION",
+     "kilt_device_onnx_graph_optimization"},
+    {"KILT_DEVICE_ONNX_EXECUTION_MODE", "kilt_device_onnx_execution_mode"},
+    {"KILT_DEVICE_ONNX_CPU_MEM_ARENA", "kilt_device_onnx_cpu_mem_arena"},
+    {"KILT_DEVICE_ONNX_MEM_PATTERN", "kilt_device_onnx_mem_pattern"},
+    {"KILT_DEVICE_ONNX_OPTIMIZED_MODEL_CACHE",
+     "kilt_device_onnx_optimized_model_cache"},
+
     // device SNPE
     {"SNPE_PERFORMANCE_PROFILE", "snpe_performance_profile"},
 
@@ -35,10 +35,66 @@ class OnnxDeviceConfig : public IDeviceConfig {
 public:
   virtual const std::string getModelRoot() const { return onnx_model_root; }
   virtual const std::string getBackendType() const { return onnx_backend_type; }
+  virtual const int getWorkerCount() const { return onnx_workers; }
+  virtual const int getSamplesQueueDepth() const { return samples_queue_depth; }
+
+  // Session tuning; 0 threads leaves the choice to ONNX Runtime.
+  virtual const std::string getLogLevel() const { return log_level; }
+  virtual const int getIntraOpThreads() const { return intra_op_threads; }
+  virtual const int getInterOpThreads() const { return inter_op_threads; }
+  virtual const bool getAllowSpinning() const { return allow_spinning; }
+  virtual const std::string getGraphOptimization() const {
+    return graph_optimization;
+  }
+  virtual const std::string getExecutionMode() const { return execution_mode; }
+  virtual const bool getCpuMemArena() const { return cpu_mem_arena; }
+  virtual const bool getMemPattern() const { return mem_pattern; }
+
+  // Directory for optimized models, empty to always optimize at startup.
+  virtual const std::string getOptimizedModelCache() const {
+    return optimized_model_cache;
+  }
 
 private:
   const std::string onnx_model_root = getconfig_s("KILT_MODEL_ROOT");
   const std::string onnx_backend_type = getconfig_s("KILT_BACKEND_TYPE");
+
+  const int onnx_workers =
+      alter_str_i(getconfig_c("KILT_DEVICE_ONNX_WORKERS"), 1);
+
+  const int samples_queue_depth =
+      alter_str_i(getconfig_c("KILT_DEVICE_ONNX_SAMPLES_QUEUE_DEPTH"), 8);
+
+  // "verbose", "info", "warning", "error" or "fatal"
+  const std::string log_level = alter_str(
+      getconfig_c("KILT_DEVICE_ONNX_LOG_LEVEL"), std::string("warning"));
+
+  const int intra_op_threads =
+      alter_str_i(getconfig_c("KILT_DEVICE_ONNX_INTRA_OP_THREADS"), 0);
+
+  const int inter_op_threads =
+      alter_str_i(getconfig_c("KILT_DEVICE_ONNX_INTER_OP_THREADS"), 0);
+
+  const bool allow_spinning =
+      getconfig_opt_b(std::string("KILT_DEVICE_ONNX_ALLOW_SPINNING"), true);
+
+  // "disable", "basic", "extended" or "all"
+  const std::string graph_optimization = alter_str(
+      getconfig_c("KILT_DEVICE_ONNX_GRAPH_OPTIMIZATION"), std::string("all"));
+
+  // "sequential" or "parallel"
+  const std::string execution_mode =
+      alter_str(getconfig_c("KILT_DEVICE_ONNX_EXECUTION_MODE"),
+                std::string("sequential"));
+
+  const bool cpu_mem_arena =
+      getconfig_opt_b(std::string("KILT_DEVICE_ONNX_CPU_MEM_ARENA"), true);
+
+  const bool mem_pattern =
+      getconfig_opt_b(std::string("KILT_DEVICE_ONNX_MEM_PATTERN"), true);
+
+  const std::string optimized_model_cache = alter_str(
+      getconfig_c("KILT_DEVICE_ONNX_OPTIMIZED_MODEL_CACHE"), std::string(""));
 };
 
 IDeviceConfig *getDeviceConfig() { return new OnnxDeviceConfig(); }
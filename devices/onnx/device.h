@@ -28,12 +28,28 @@
 #include "config/device_config.h"
 #include "idatasource.h"
 #include "imodel.h"
+#include "plugins/work-queue/work_queue.h"
+#include "session.h"
 #include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <onnxruntime_cxx_api.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 #define LARGE_BUFFER 4000000
 
+// ONNX Runtime aligns its own CPU allocations to 64 bytes
+#define ONNX_BUFFER_ALIGNMENT 64
+
+// buffer sets per worker: one runs while the other's results are consumed
+#define ONNX_WORKER_SETS 2
+
 using namespace KRAI;
 
 template <typename Sample> class Device : public IDevice<Sample> {
@@ -52,14 +68,14 @@ public:
     // load model from config path
     std::string model_path = device_cfg->getModelRoot();
     std::ifstream f(model_path.c_str());
-    if (f.good())
+    bool model_found = f.good();
+    if (model_found)
       std::cout << "Loading model at " << model_path << std::endl;
     else
       std::cerr << "Model not found at " << model_path << std::endl;
 
-    Ort::SessionOptions session_options;
-
-    env = Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_VERBOSE, "ort_resnet50");
+    env = Ort::Env(OnnxSessionFactory::logLevel(device_cfg->getLogLevel()),
+                   "ort_resnet50");
 
     auto providers = Ort::GetAvailableProviders();
     std::cout << "Available providers:" << std::endl;
@@ -70,18 +86,18 @@ public:
     std::string backend_type = device_cfg->getBackendType();
     std::cout << "Using backend: " << backend_type << std::endl;
 
-    if (backend_type == "gpu") {
-      OrtCUDAProviderOptions cuda_options;
-      cuda_options.cudnn_conv_algo_search = OrtCudnnConvAlgoSearchHeuristic;
-      session_options.AppendExecutionProvider_CUDA(cuda_options);
-    }
+    gpu_backend = backend_type == "gpu";
 
-    session = new Ort::Session{env, model_path.c_str(), session_options};
-    if (!session) {
-      std::cerr << "Failed to create Onnxrt session" << std::endl;
-    } else {
-      std::cout << "Successfully created Onnxrt session" << std::endl;
-    }
+    OnnxSessionFactory session_factory(device_cfg);
+    float startup_ms;
+    bool from_cache;
+    session = session_factory.create(env, startup_ms, from_cache);
+
+    std::cout << "Successfully created Onnxrt session in " << startup_ms
+              << " ms";
+    if (from_cache)
+      std::cout << " from optimized model " << session_factory.getCachedPath();
+    std::cout << std::endl;
 
     // get num of input and output nodes
     numInputNodes = session->GetInputCount();
@@ -137,69 +153,231 @@ public:
       output_names.push_back(outputNameChar);
     }
 
-    // create dummy input buffers for device
-    for (int i = 0; i < numInputNodes; ++i) {
-      uint8_t *raw_input = new uint8_t[model_cfg->getInputByteSize(i)];
-      buffers_in.push_back(raw_input);
+    // tensors are only described once, on host memory owned by the device
+    memory_info = new Ort::MemoryInfo(
+        Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault));
+
+    samples_queue_depth = device_cfg->getSamplesQueueDepth();
+    samples_queue = new MPMCQueue<std::vector<Sample>>(samples_queue_depth);
+
+    int num_workers = device_cfg->getWorkerCount();
+    if (num_workers < 1)
+      throw "KILT_DEVICE_ONNX_WORKERS must be at least 1";
+
+    // all workers share the session, each runs its own buffer sets
+    for (int i = 0; i < num_workers; ++i) {
+      Worker *w = new Worker();
+      for (int s = 0; s < ONNX_WORKER_SETS; ++s) {
+        createBufferSet(w->sets[s]);
+        w->sets[s].owner = w;
+      }
+      workers.push_back(w);
     }
 
-    // create dummy output buffers for device
-    for (int i = 0; i < numOutputNodes; ++i) {
-      uint8_t *raw_output = new uint8_t[model_cfg->getOutputByteSize(i)];
-      buffers_out.push_back(raw_output);
+    for (int i = 0; i < num_workers; ++i) {
+      workers[i]->thread = std::thread(&Device::WorkerLoop, this, workers[i]);
+
+      // pin workers to the device's CPUs, wrapping round if there are more
+      // workers than CPUs
+      if (aff.empty())
+        continue;
+
+      int cpu = aff[i % aff.size()];
+      std::cout << "ONNX worker thread " << cpu << std::endl;
+
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      pthread_setaffinity_np(workers[i]->thread.native_handle(),
+                             sizeof(cpu_set_t), &cpu_set);
     }
   }
 
   virtual int Inference(std::vector<Sample> samples) {
 
-    // populate device input buffers from datasource
-    model->configureWorkload(data_source, &samples, buffers_in);
+    if (!samples_queue->push(std::move(samples)))
+      return -1;
+    wake_signal.notify();
 
-    // do device specific inference here
-    Ort::MemoryInfo memory_info =
-        Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault);
+    return samples_queue_depth - int(samples_queue->size());
+  }
 
-    for (int xx = 0; xx < numInputNodes; ++xx) {
-      std::vector<int64_t> dims = input_shapes.at(xx);
-      inputs.push_back(Ort::Value::CreateTensor(
-          memory_info, buffers_in.at(xx), model_cfg->getInputByteSize(xx),
-          dims.data(), dims.size(), input_types.at(xx)));
+  ~Device() {
+    // the workers empty the samples queue before they exit
+    terminate = true;
+    wake_signal.notify();
+    for (Worker *w : workers) {
+      w->signal.notify();
+      w->thread.join();
     }
+    for (Worker *w : workers) {
+      for (int s = 0; s < ONNX_WORKER_SETS; ++s) {
+        // results still being consumed by the model
+        for (;;) {
+          uint32_t epoch = w->signal.epoch();
+          if (!w->sets[s].busy.load(std::memory_order_acquire))
+            break;
+          w->signal.wait(epoch);
+        }
+        destroyBufferSet(w->sets[s]);
+      }
+      delete w;
+    }
+    delete samples_queue;
+    delete memory_info;
+    delete session;
+    for (const char *name : input_names)
+      free(const_cast<char *>(name));
+    for (const char *name : output_names)
+      free(const_cast<char *>(name));
+  }
 
-    for (int xx = 0; xx < numOutputNodes; ++xx) {
-      std::vector<int64_t> dims = output_shapes.at(xx);
-      outputs.push_back(Ort::Value::CreateTensor(
-          memory_info, buffers_out.at(xx), model_cfg->getOutputByteSize(xx),
-          dims.data(), dims.size(), output_types.at(xx)));
+private:
+  struct Worker;
+
+  // Host buffers for one inference in flight, together with the tensors
+  // wrapping them and an IoBinding built over those tensors. busy stays set
+  // from the run until the model has consumed the outputs.
+  struct BufferSet {
+    std::vector<void *> buffers_in;
+    std::vector<void *> buffers_out;
+    std::vector<Ort::Value> tensors;
+    Ort::IoBinding *binding = nullptr;
+    std::vector<Sample> samples;
+    std::atomic<bool> busy{false};
+    Worker *owner = nullptr;
+  };
+
+  struct Worker {
+    std::thread thread;
+    BufferSet sets[ONNX_WORKER_SETS];
+    // notified when one of the sets is released
+    WakeSignal signal;
+  };
+
+  // Takes batches off the samples queue and runs them on the worker's buffer
+  // sets in turn. Results are posted asynchronously, so the next batch can
+  // run on the other set while the model is still consuming the outputs.
+  void WorkerLoop(Worker *w) {
+    int next = 0;
+
+    for (;;) {
+      BufferSet &set = w->sets[next];
+
+      // wait for the model to hand back this set's outputs
+      uint32_t set_epoch = w->signal.epoch();
+      if (set.busy.load(std::memory_order_acquire)) {
+        w->signal.wait(set_epoch);
+        continue;
+      }
+
+      // take the next batch off the queue, sleeping until one is pushed.
+      // Once terminating, the batches still queued are run before leaving.
+      uint32_t epoch = wake_signal.epoch();
+      // terminate is read after taking the epoch, so the destructor's
+      // notify cannot slip in unnoticed before the wait, and before the
+      // pop, so no batch pushed ahead of it is left behind
+      bool terminating = terminate;
+      if (!samples_queue->pop(set.samples)) {
+        if (terminating)
+          break;
+        wake_signal.wait(epoch);
+        continue;
+      }
+
+      set.busy.store(true, std::memory_order_relaxed);
+
+      // populate device input buffers from datasource
+      model->configureWorkload(data_source, &set.samples, set.buffers_in);
+
+      // the binding already points at buffers_in / buffers_out, so running
+      // it allocates nothing and creates no tensors
+      session->Run(run_options, *set.binding);
+      if (gpu_backend)
+        set.binding->SynchronizeOutputs();
+
+      // pass device output buffers to model specific post processing
+      model->postprocessResultsAsync(&set.samples, set.buffers_out, &set,
+                                     ReleaseBufferSet);
+
+      next = (next + 1) % ONNX_WORKER_SETS;
     }
+  }
+
+  static void ReleaseBufferSet(void *handle) {
+    BufferSet *set = (BufferSet *)handle;
+    set->busy.store(false, std::memory_order_release);
+    set->owner->signal.notify();
+  }
 
-    Ort::RunOptions run_options;
-    session->Run(run_options, input_names.data(), inputs.data(), numInputNodes,
-                 output_names.data(), outputs.data(), numOutputNodes);
+  static void *allocBuffer(size_t size) {
+    // aligned_alloc wants the size to be a multiple of the alignment
+    size_t rounded = (size + ONNX_BUFFER_ALIGNMENT - 1) &
+                     ~size_t(ONNX_BUFFER_ALIGNMENT - 1);
+    void *buf = aligned_alloc(ONNX_BUFFER_ALIGNMENT, rounded);
+    if (buf == nullptr)
+      throw "Failed to allocate ONNX device buffer";
+    return buf;
+  }
 
-    // pass device output buffers to model specific post processing
-    model->postprocessResults(&samples, buffers_out);
+  void createBufferSet(BufferSet &set) {
+    set.binding = new Ort::IoBinding(*session);
+    set.tensors.reserve(numInputNodes + numOutputNodes);
+
+    for (size_t i = 0; i < numInputNodes; ++i) {
+      size_t size = model_cfg->getInputByteSize(i);
+      void *buf = allocBuffer(size);
+      set.buffers_in.push_back(buf);
+      std::vector<int64_t> &dims = input_shapes.at(i);
+      set.tensors.push_back(Ort::Value::CreateTensor(
+          *memory_info, buf, size, dims.data(), dims.size(),
+          input_types.at(i)));
+      set.binding->BindInput(input_names.at(i), set.tensors.back());
+    }
 
-    return 0;
+    for (size_t i = 0; i < numOutputNodes; ++i) {
+      size_t size = model_cfg->getOutputByteSize(i);
+      void *buf = allocBuffer(size);
+      set.buffers_out.push_back(buf);
+      std::vector<int64_t> &dims = output_shapes.at(i);
+      set.tensors.push_back(Ort::Value::CreateTensor(
+          *memory_info, buf, size, dims.data(), dims.size(),
+          output_types.at(i)));
+      set.binding->BindOutput(output_names.at(i), set.tensors.back());
+    }
   }
 
-  ~Device() { delete session; }
+  void destroyBufferSet(BufferSet &set) {
+    // the binding and tensors reference the buffers, release them first
+    delete set.binding;
+    set.binding = nullptr;
+    set.tensors.clear();
+    for (void *buf : set.buffers_in)
+      free(buf);
+    for (void *buf : set.buffers_out)
+      free(buf);
+    set.buffers_in.clear();
+    set.buffers_out.clear();
+  }
 
-private:
   OnnxDeviceConfig *device_cfg;
   IModelConfig *model_cfg;
 
-  // activations, set, input buffers
-  std::vector<void *> buffers_in;
-
-  // activation, set, output buffers
-  std::vector<void *> buffers_out;
-
   IModel *model;
   IDataSource *data_source;
 
-  std::vector<Ort::Value> inputs;
-  std::vector<Ort::Value> outputs;
+  std::vector<Worker *> workers;
+  std::atomic<bool> terminate{false};
+
+  // batches waiting for a worker; Inference returns the free space so
+  // Dispatch feels the back pressure
+  MPMCQueue<std::vector<Sample>> *samples_queue;
+  int samples_queue_depth;
+  WakeSignal wake_signal;
+
+  Ort::MemoryInfo *memory_info;
+  Ort::RunOptions run_options;
+  bool gpu_backend;
 
   size_t numInputNodes;
   size_t numOutputNodes;
@@ -0,0 +1,222 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef ONNX_SESSION_H
+#define ONNX_SESSION_H
+
+#include "config/device_config.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <onnxruntime_cxx_api.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace KRAI {
+
+// Creates ONNX Runtime sessions for the model, backend and session options
+// in the device config.
+class OnnxSessionFactory {
+public:
+  OnnxSessionFactory(const OnnxDeviceConfig *device_cfg)
+      : device_cfg(device_cfg) {}
+
+  // Creates a session, timing it. With a cache directory, the model
+  // optimized under these options is saved on the first start and loaded as
+  // is, without optimizing it again, on later ones.
+  Ort::Session *create(Ort::Env &env, float &startup_ms, bool &from_cache) {
+
+    Ort::SessionOptions session_options;
+    configureSession(session_options);
+
+    std::string model_path = device_cfg->getModelRoot();
+    std::string backend_type = device_cfg->getBackendType();
+
+    if (backend_type == "gpu") {
+      OrtCUDAProviderOptions cuda_options;
+      cuda_options.cudnn_conv_algo_search = OrtCudnnConvAlgoSearchHeuristic;
+      session_options.AppendExecutionProvider_CUDA(cuda_options);
+    }
+
+    std::string load_path = model_path;
+    std::string staged_path;
+    std::string cache_dir = device_cfg->getOptimizedModelCache();
+    std::ifstream f(model_path.c_str());
+    cached_path.clear();
+    if (!cache_dir.empty() && f.good()) {
+      mkdir(cache_dir.c_str(), 0755);
+      cached_path =
+          cache_dir + "/" + optimizedModelKey(model_path, backend_type) +
+          ".onnx";
+      std::ifstream cached(cached_path.c_str());
+      if (cached.good()) {
+        load_path = cached_path;
+        session_options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+      } else {
+        // written under a private name and published once complete, so a
+        // concurrent start never loads a partial model
+        staged_path = cached_path + "." + std::to_string(getpid()) + ".tmp";
+        session_options.SetOptimizedModelFilePath(staged_path.c_str());
+      }
+    }
+    from_cache = load_path == cached_path;
+
+    Ort::Session *session;
+    auto start = std::chrono::steady_clock::now();
+    try {
+      session = new Ort::Session{env, load_path.c_str(), session_options};
+    } catch (...) {
+      // do not leave a partly written model behind in the cache
+      if (!staged_path.empty())
+        remove(staged_path.c_str());
+      throw;
+    }
+    startup_ms = std::chrono::duration<float, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+    if (!staged_path.empty() &&
+        rename(staged_path.c_str(), cached_path.c_str()) != 0)
+      std::cerr << "Failed to store optimized model at " << cached_path
+                << std::endl;
+
+    return session;
+  }
+
+  // Path of the optimized model in the cache for the last session created,
+  // empty without a cache.
+  const std::string &getCachedPath() const { return cached_path; }
+
+  static OrtLoggingLevel logLevel(const std::string &level) {
+    if (level == "verbose")
+      return ORT_LOGGING_LEVEL_VERBOSE;
+    if (level == "info")
+      return ORT_LOGGING_LEVEL_INFO;
+    if (level == "warning")
+      return ORT_LOGGING_LEVEL_WARNING;
+    if (level == "error")
+      return ORT_LOGGING_LEVEL_ERROR;
+    if (level == "fatal")
+      return ORT_LOGGING_LEVEL_FATAL;
+    throw "Unknown ONNX log level";
+  }
+
+private:
+  void configureSession(Ort::SessionOptions &options) {
+    if (device_cfg->getIntraOpThreads() > 0)
+      options.SetIntraOpNumThreads(device_cfg->getIntraOpThreads());
+    if (device_cfg->getInterOpThreads() > 0)
+      options.SetInterOpNumThreads(device_cfg->getInterOpThreads());
+
+    const char *spin = device_cfg->getAllowSpinning() ? "1" : "0";
+    options.AddConfigEntry("session.intra_op.allow_spinning", spin);
+    options.AddConfigEntry("session.inter_op.allow_spinning", spin);
+
+    options.SetGraphOptimizationLevel(
+        graphOptimizationLevel(device_cfg->getGraphOptimization()));
+
+    std::string mode = device_cfg->getExecutionMode();
+    if (mode == "sequential")
+      options.SetExecutionMode(ORT_SEQUENTIAL);
+    else if (mode == "parallel")
+      options.SetExecutionMode(ORT_PARALLEL);
+    else
+      throw "Unknown ONNX execution mode";
+
+    if (device_cfg->getCpuMemArena())
+      options.EnableCpuMemArena();
+    else
+      options.DisableCpuMemArena();
+
+    if (device_cfg->getMemPattern())
+      options.EnableMemPattern();
+    else
+      options.DisableMemPattern();
+  }
+
+  static GraphOptimizationLevel
+  graphOptimizationLevel(const std::string &level) {
+    if (level == "disable")
+      return ORT_DISABLE_ALL;
+    if (level == "basic")
+      return ORT_ENABLE_BASIC;
+    if (level == "extended")
+      return ORT_ENABLE_EXTENDED;
+    if (level == "all")
+      return ORT_ENABLE_ALL;
+    throw "Unknown ONNX graph optimization level";
+  }
+
+  // Names the optimized model by what it depends on: the source model's
+  // contents, the backend and optimization level, the runtime version and,
+  // as layout optimizations are ISA specific, the host's vector extensions.
+  std::string optimizedModelKey(const std::string &model_path,
+                                const std::string &backend_type) {
+    std::string isa;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx512f"))
+      isa = "avx512";
+    else if (__builtin_cpu_supports("avx2"))
+      isa = "avx2";
+#endif
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             (unsigned long long)hashFile(model_path));
+    return std::string(hash) + "-" + backend_type + "-" +
+           device_cfg->getGraphOptimization() + "-ort" +
+           std::to_string(ORT_API_VERSION) + (isa.empty() ? "" : "-") + isa;
+  }
+
+  // FNV-1a style hash taken a word at a time, with an extra shift to fold
+  // the high bits back down; only used to tell models apart.
+  static uint64_t hashFile(const std::string &path) {
+    std::ifstream f(path.c_str(), std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    uint64_t h = 14695981039346656037ull;
+    while (f) {
+      f.read(chunk.data(), chunk.size());
+      size_t n = f.gcount();
+      size_t i = 0;
+      for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, &chunk[i], sizeof(w));
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 32;
+      }
+      for (; i < n; ++i)
+        h = (h ^ (uint8_t)chunk[i]) * 1099511628211ull;
+    }
+    return h;
+  }
+
+  const OnnxDeviceConfig *device_cfg;
+  std::string cached_path;
+};
+
+} // namespace KRAI
+
+#endif // ONNX_SESSION_H
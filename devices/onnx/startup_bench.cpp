@@ -0,0 +1,152 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Startup benchmark for ONNX Runtime sessions.
+//
+// Times session creation the way the ONNX device does it, for every graph
+// optimization level and execution mode, three ways: without a cache (the
+// graph is optimized on every start), cold (a cache miss, which optimizes
+// the graph and stores it) and warm (a cache hit, which loads the stored
+// model without optimizing it). The median of each over the runs is
+// reported.
+//
+// The model and the other session options are read from the environment as
+// for the device (KILT_MODEL_ROOT, KILT_BACKEND_TYPE, KILT_DEVICE_ONNX_*),
+// under the names of the translation table built in.
+// The cache lives in a private temporary directory that is removed
+// afterwards, so KILT_DEVICE_ONNX_OPTIMIZED_MODEL_CACHE is not used.
+//
+// Build and run, from the repository root:
+//   g++ -std=c++17 -O2 -DKILT_CONFIG_FROM_ENV=1 -DKILT_CONFIG_TRANSLATE_X=1 -I. -Idevices/onnx -I<onnxruntime>/include devices/onnx/startup_bench.cpp -L<onnxruntime>/lib -lonnxruntime -o startup_bench
+//   kilt_model_root=<model.onnx> kilt_backend_type=cpu ./startup_bench [runs=5]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "config/device_config.h"
+#include "session.h"
+
+using namespace KRAI;
+
+static void setConfig(const char *key, const char *value) {
+  std::string name = TranslationTable::getTranslation(key);
+  if (value != nullptr)
+    setenv(name.c_str(), value, 1);
+  else
+    unsetenv(name.c_str());
+}
+
+static float median(std::vector<float> v) {
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+// Creates and destroys one session, returning the time it took to create.
+static float timeSession(Ort::Env &env, const char *cache_dir,
+                         bool &from_cache, std::string &cached_path) {
+  setConfig("KILT_DEVICE_ONNX_OPTIMIZED_MODEL_CACHE", cache_dir);
+  OnnxDeviceConfig device_cfg;
+  OnnxSessionFactory session_factory(&device_cfg);
+
+  float startup_ms;
+  delete session_factory.create(env, startup_ms, from_cache);
+  cached_path = session_factory.getCachedPath();
+  return startup_ms;
+}
+
+int main(int argc, char **argv) {
+  int runs = argc > 1 ? atoi(argv[1]) : 5;
+  if (runs < 1) {
+    fprintf(stderr, "usage: %s [runs=5]\n", argv[0]);
+    return 1;
+  }
+
+  char cache_dir[] = "/tmp/kilt_onnx_startup.XXXXXX";
+  if (mkdtemp(cache_dir) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  const char *levels[] = {"disable", "basic", "extended", "all"};
+  const char *modes[] = {"sequential", "parallel"};
+
+  try {
+    OnnxDeviceConfig base_cfg;
+    Ort::Env env(OnnxSessionFactory::logLevel(base_cfg.getLogLevel()),
+                 "startup_bench");
+
+    std::vector<std::string> reports;
+    for (const char *level : levels) {
+      for (const char *mode : modes) {
+        setConfig("KILT_DEVICE_ONNX_GRAPH_OPTIMIZATION", level);
+        setConfig("KILT_DEVICE_ONNX_EXECUTION_MODE", mode);
+
+        std::vector<float> uncached, cold, warm;
+        bool from_cache;
+        std::string cached_path;
+        for (int r = 0; r < runs; ++r) {
+          uncached.push_back(
+              timeSession(env, nullptr, from_cache, cached_path));
+
+          cold.push_back(timeSession(env, cache_dir, from_cache, cached_path));
+          if (from_cache)
+            throw "Optimized model found in a fresh cache";
+
+          warm.push_back(timeSession(env, cache_dir, from_cache, cached_path));
+          if (!from_cache)
+            throw "Optimized model not stored in the cache";
+
+          remove(cached_path.c_str());
+        }
+
+        char line[160];
+        snprintf(line, sizeof(line),
+                 "%-8s %-10s: uncached %9.2f ms, cold %9.2f ms, "
+                 "warm %9.2f ms",
+                 level, mode, median(uncached), median(cold), median(warm));
+        reports.push_back(line);
+      }
+    }
+
+    // the config readers log every key, so report once they are done
+    printf("\n%s, %d runs, median session creation time\n",
+           base_cfg.getModelRoot().c_str(), runs);
+    for (const std::string &line : reports)
+      printf("%s\n", line.c_str());
+  } catch (const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    rmdir(cache_dir);
+    return 1;
+  } catch (const std::string &msg) {
+    fprintf(stderr, "%s\n", msg.c_str());
+    rmdir(cache_dir);
+    return 1;
+  }
+
+  rmdir(cache_dir);
+  return 0;
+}
@@ -0,0 +1,175 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "QAicInfApi.h"
+
+namespace qaic_api {
+
+const uint32_t setSizeDefault = 10;
+const uint32_t numActivationsDefault = 1;
+const uint32_t numThreadsPerQueueDefault = 4;
+const uint32_t latencyDefault = 1000;
+
+QAicInfApi::QAicInfApi()
+    : dev_(0), numThreadsPerQueue_(numThreadsPerQueueDefault),
+      setSize_(setSizeDefault), latency_(latencyDefault), concurrency_(0),
+      terminate_(false), completed_(0), callback_(nullptr) {}
+
+QAicInfApi::~QAicInfApi() { deinit(); }
+
+void QAicInfApi::setModelBasePath(std::string modelBasePath) {
+  modelBasePaths_.push_back(modelBasePath);
+}
+
+// As in the master version, every activation runs the first model.
+void QAicInfApi::setNumActivations(uint32_t num) {
+
+  for (uint32_t i = 1; i < num; ++i)
+    modelBasePaths_.push_back(modelBasePaths_[0]);
+}
+
+void QAicInfApi::setNumThreadsPerQueue(uint32_t num) {
+  numThreadsPerQueue_ = num;
+}
+
+void QAicInfApi::setSetSize(uint32_t setSize) { setSize_ = setSize; }
+
+void QAicInfApi::setLibPath(std::string & /*aicLibPath*/) {}
+
+void QAicInfApi::setSkipStage(std::string /*qaic_skip_stage*/) {}
+
+void QAicInfApi::setBufferSizes(const std::vector<size_t> &sizes) {
+  bufferSizes_ = sizes;
+}
+
+void QAicInfApi::setLatency(uint32_t us) { latency_ = us; }
+
+void QAicInfApi::setConcurrency(uint32_t num) { concurrency_ = num; }
+
+QStatus QAicInfApi::init(QID qid, QAicEventCallback callback,
+                         bool /*dump_descriptors*/) {
+
+  callback_ = callback;
+  dev_ = qid;
+
+  if (bufferSizes_.empty()) {
+    std::cerr << "Emulated device " << dev_ << " has no buffer sizes"
+              << std::endl;
+    return QS_ERROR;
+  }
+
+  uint32_t numActivations = modelBasePaths_.size();
+
+  // Create IO buffers
+  inferenceBuffersList_.resize(numActivations);
+  for (uint32_t a = 0; a < numActivations; ++a) {
+    inferenceBuffersList_[a].resize(setSize_);
+    for (uint32_t s = 0; s < setSize_; ++s) {
+      for (size_t size : bufferSizes_) {
+        inferenceBufferVector_.emplace_back(new uint8_t[size]());
+        QBuffer buf;
+        buf.size = size;
+        buf.buf = inferenceBufferVector_.back().get();
+        inferenceBuffersList_[a][s].push_back(buf);
+      }
+    }
+  }
+
+  uint32_t concurrency = concurrency_ ? concurrency_ : numActivations;
+
+  std::cout << "Emulated device " << dev_ << ": " << numActivations
+            << " activations, " << concurrency << " concurrent inferences of "
+            << latency_ << "us" << std::endl;
+
+  terminate_ = false;
+  for (uint32_t i = 0; i < concurrency; ++i)
+    cores_.push_back(std::thread(&QAicInfApi::emulateCore, this));
+
+  return QS_SUCCESS;
+}
+
+QStatus QAicInfApi::run(uint32_t activation, uint32_t execobj,
+                        void *payload) {
+
+  if (activation >= inferenceBuffersList_.size() ||
+      execobj >= inferenceBuffersList_[activation].size())
+    return QS_ERROR;
+
+  std::unique_lock<std::mutex> lock(mtx_);
+  if (terminate_)
+    return QS_ERROR;
+  pending_.push_back(payload);
+  cv_.notify_one();
+
+  return QS_SUCCESS;
+}
+
+void QAicInfApi::emulateCore() {
+
+  while (true) {
+    void *payload;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [this] { return terminate_ || !pending_.empty(); });
+      if (pending_.empty())
+        return;
+      payload = pending_.front();
+      pending_.pop_front();
+    }
+
+    std::this_thread::sleep_for(std::chrono::microseconds(latency_));
+
+    ++completed_;
+    callback_(nullptr, QAIC_EVENT_DEVICE_COMPLETE, payload);
+  }
+}
+
+// Stops the emulated card once the inferences still queued have completed,
+// so every payload passed to run() gets its callback.
+QStatus QAicInfApi::deinit() {
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    terminate_ = true;
+    cv_.notify_all();
+  }
+  for (std::thread &t : cores_)
+    t.join();
+  cores_.clear();
+
+  return QS_SUCCESS;
+}
+
+uint64_t QAicInfApi::getInfCompletedCount() { return completed_; }
+
+bool QAicInfApi::isBatchMode() { return false; }
+
+QStatus QAicInfApi::setBufferPtr(uint32_t act_idx, uint32_t set_idx,
+                                 uint32_t buf_idx, void *ptr) {
+  inferenceBuffersList_[act_idx][set_idx][buf_idx].buf =
+      static_cast<uint8_t *>(ptr);
+
+  return QS_SUCCESS;
+}
+
+} // namespace qaic_api
@@ -0,0 +1,146 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Stand-in for the QAIC runtime with the interface of
+// api/master/QAicInfApi.h, for running the QAIC device without the SDK or a
+// card. Build with QAIC_EMULATED defined and this directory's
+// QAicInfApi.cpp in place of the master one.
+//
+// Each activation gets setSize sets of zeroed host buffers of the sizes
+// given with setBufferSizes. run() queues the set on an emulated card that
+// executes up to setConcurrency inferences at a time, each taking
+// setLatency microseconds, and then calls the completion callback from the
+// card's thread as the driver would. Output buffers are left as they are.
+// deinit() completes the inferences still queued before it stops the card.
+
+#ifndef QAIC_EMULATED_INF_API_H_
+#define QAIC_EMULATED_INF_API_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The runtime types used by the device.
+
+enum QStatus { QS_SUCCESS = 0, QS_ERROR = 1 };
+
+typedef uint32_t QID;
+
+struct QBuffer {
+  size_t size;
+  uint8_t *buf;
+};
+
+// Never created, completion callbacks get nullptr.
+struct QAicEvent;
+
+enum QAicEventCompletionType { QAIC_EVENT_DEVICE_COMPLETE = 0 };
+
+typedef void (*QAicEventCallback)(QAicEvent *event,
+                                  QAicEventCompletionType eventCompletion,
+                                  void *userData);
+
+namespace qaic_api {
+
+extern const uint32_t setSizeDefault;
+extern const uint32_t numActivationsDefault;
+extern const uint32_t numThreadsPerQueueDefault;
+extern const uint32_t latencyDefault;
+
+class QAicInfApi {
+public:
+  QAicInfApi();
+
+  virtual ~QAicInfApi();
+
+  void setModelBasePath(std::string modelBasePath);
+  void setNumActivations(uint32_t num);
+  void setNumThreadsPerQueue(uint32_t num);
+  void setSetSize(uint32_t num);
+  void setLibPath(std::string &aicLibPath);
+  void setSkipStage(std::string qaic_skip_stage);
+
+  // Emulation parameters, to be set before init.
+  // bytes of each buffer of a set, inputs then outputs
+  void setBufferSizes(const std::vector<size_t> &sizes);
+  // microseconds per inference
+  void setLatency(uint32_t us);
+  // inferences in flight at once, 0 for one per activation
+  void setConcurrency(uint32_t num);
+
+  QStatus init(QID qid, QAicEventCallback callback,
+               bool dump_descriptors = false);
+
+  QStatus run(uint32_t activation, uint32_t execobj, void *payload);
+
+  QStatus deinit();
+  uint64_t getInfCompletedCount();
+  bool isBatchMode();
+
+  void *getBufferPtr(uint32_t act_idx, uint32_t exec_idx, uint32_t buf_idx) {
+    return inferenceBuffersList_[act_idx][exec_idx][buf_idx].buf;
+  }
+
+  QStatus setBufferPtr(uint32_t act_idx, uint32_t set_idx, uint32_t buf_idx,
+                       void *ptr);
+
+private:
+  // Executes queued inferences, one at a time.
+  void emulateCore();
+
+  std::vector<std::vector<std::vector<QBuffer>>> inferenceBuffersList_;
+  std::vector<std::unique_ptr<uint8_t[]>> inferenceBufferVector_;
+  std::vector<std::string> modelBasePaths_;
+  std::vector<size_t> bufferSizes_;
+  QID dev_;
+  uint32_t numThreadsPerQueue_;
+  uint32_t setSize_;
+  uint32_t latency_;
+  uint32_t concurrency_;
+
+  // the emulated card
+  std::vector<std::thread> cores_;
+  std::deque<void *> pending_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool terminate_;
+  std::atomic<uint64_t> completed_;
+
+  // Callback
+  QAicEventCallback callback_;
+
+}; // QAicInfApi
+
+} // namespace qaic_api
+
+#endif
@@ -0,0 +1,184 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+// End to end run of the QAIC device on the emulated runtime.
+//
+// A device with three activations is fed 2000 single sample batches and
+// must complete each exactly once, with 0, 1 and 2 enqueue threads in turn.
+// Each is run twice: once deleting the device after all results are back,
+// and once deleting it right after the last batch is queued, when the
+// batches still queued and in flight must complete during shutdown.
+// Settings not fixed here, such as the activation policy, are read from
+// the environment as usual.
+//
+// Build and run, from this directory:
+//   g++ -std=c++17 -O2 -pthread -I../../../.. device_test.cpp QAicInfApi.cpp
+//   ./a.out
+
+#define KILT_CONFIG_FROM_ENV 1
+#define KILT_CONFIG_TRANSLATE_X 1
+#define QAIC_EMULATED 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iconfig.h"
+#include "idevice.h"
+#include "imodel.h"
+
+#include "devices/qaic/config/device_config.h"
+#include "devices/qaic/device.h"
+
+using namespace KRAI;
+
+namespace KRAI {
+
+class TestServerConfig : public IServerConfig {
+public:
+  const int getMaxWait() const override { return 0; }
+  const int getVerbosity() const override { return 0; }
+  const int getVerbosityServer() const override { return 0; }
+  const int getBatchSize() const override { return 1; }
+
+  const int getDeviceCount() const override { return 1; }
+  const int getDeviceId(int idx) const override { return 0; }
+  const std::vector<int> getDeviceAffinity(int device_id) override {
+    return {0};
+  }
+
+  const int getDataSourceIdForDevice(int device) override { return 0; }
+  const int getDataSourceCount() override { return 1; }
+  const std::vector<int> getDataSourceAffinity(int data_source_id) override {
+    return {0};
+  }
+
+  const std::string &getUniqueServerID() override { return id; }
+
+  const int getSchedulerYieldTime() override { return 0; }
+  const int getDispatchYieldTime() override { return 0; }
+
+private:
+  std::string id = "qaic_device_test";
+};
+
+IServerConfig *getServerConfig() { return new TestServerConfig; }
+IModelConfig *getModelConfig() { return new IModelConfig; }
+IDataSourceConfig *getDataSourceConfig() { return nullptr; }
+
+} // namespace KRAI
+
+// Writes the sample index to the input and counts the results back.
+class TestModel : public IModel {
+public:
+  TestModel(long batches) : seen(batches) {}
+
+  void configureWorkload(IDataSource *data_source, const void *samples,
+                         std::vector<void *> &in_ptrs) override {
+    const std::vector<int> *s = static_cast<const std::vector<int> *>(samples);
+    static_cast<int *>(in_ptrs[0])[0] = (*s)[0];
+  }
+
+  void postprocessResults(void *samples,
+                          std::vector<void *> &out_ptrs) override {
+    std::vector<int> *s = static_cast<std::vector<int> *>(samples);
+    ++seen[(*s)[0]];
+    ++done;
+  }
+
+  // every batch completed exactly once
+  bool exactlyOnce() const {
+    for (const std::atomic<int> &n : seen)
+      if (n != 1)
+        return false;
+    return true;
+  }
+
+  std::vector<std::atomic<int>> seen;
+  std::atomic<long> done{0};
+};
+
+static void setConfig(const char *key, const std::string &value) {
+  setenv(TranslationTable::getTranslation(key).c_str(), value.c_str(), 1);
+}
+
+static bool run(int enqueue_threads, long batches, bool wait) {
+  setConfig("KILT_DEVICE_QAIC_ENQUEUE_THREADS",
+            std::to_string(enqueue_threads));
+
+  IConfig config;
+  TestModel model(batches);
+  IDevice<int> *device =
+      createDevice<int>(&model, nullptr, &config, 0, {0, 0, 0, 0, 0});
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < batches; ++i) {
+    std::vector<int> samples = {int(i)};
+    while (device->Inference(samples) < 0)
+      std::this_thread::yield();
+  }
+  long queued = batches - model.done;
+  while (wait && model.done < batches)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  delete device;
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  bool ok = model.done == batches && model.exactlyOnce();
+  printf("%d enqueue threads, %s: %ld of %ld batches, %.0f inferences/s, "
+         "%s\n",
+         enqueue_threads,
+         wait ? "results back before delete"
+              : ("deleted with " + std::to_string(queued) + " pending")
+                    .c_str(),
+         long(model.done), batches, batches / elapsed, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main() {
+  setConfig("KILT_MODEL_BATCH_SIZE", "1");
+  setConfig("KILT_MODEL_INPUT_FORMAT", "INT32,1,16");
+  setConfig("KILT_MODEL_OUTPUT_FORMAT", "FLOAT32,1,100:INT64,1,4");
+  setConfig("KILT_MODEL_ROOT", "/nonexistent");
+  setConfig("KILT_DEVICE_QAIC_ACTIVATION_COUNT", "3");
+  setConfig("KILT_DEVICE_QAIC_QUEUE_LENGTH", "2");
+  setConfig("KILT_DEVICE_QAIC_RINGFENCE_DRIVER", "0");
+  setConfig("KILT_DEVICE_QAIC_EMULATED_LATENCY", "200");
+  setConfig("KILT_DEVICE_QAIC_EMULATED_CONCURRENCY", "2");
+
+  bool ok = true;
+  for (int enqueue_threads = 0; enqueue_threads <= 2; ++enqueue_threads) {
+    ok = run(enqueue_threads, 2000, true) && ok;
+    ok = run(enqueue_threads, 2000, false) && ok;
+  }
+
+  printf(ok ? "PASSED\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
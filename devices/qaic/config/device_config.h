@@ -48,11 +48,19 @@ public:
 
   virtual const int getSamplesQueueDepth() const { return samples_queue_depth; }
 
-  virtual const int getSchedulerYieldTime() { return scheduler_yield_time; }
-  virtual const int getEnqueueYieldTime() { return enqueue_yield_time; }
+  virtual const int getEnqueueThreadCount() { return enqueue_threads; }
+  virtual const std::string getActivationPolicy() const {
+    return activation_policy;
+  }
 
   virtual const bool getLoopback() const { return qaic_loopback; }
 
+  // Parameters of the emulated runtime (QAIC_EMULATED builds).
+  virtual const int getEmulatedLatency() const { return emulated_latency; }
+  virtual const int getEmulatedConcurrency() const {
+    return emulated_concurrency;
+  }
+
 private:
   const char *qaic_model_root = getconfig_c("KILT_MODEL_ROOT");
 
@@ -77,14 +85,24 @@ private:
   const bool qaic_ringfence_driver =
       getconfig_opt_b(std::string("KILT_DEVICE_QAIC_RINGFENCE_DRIVER"), true);
 
-  const int scheduler_yield_time =
-      alter_str_i(getconfig_c("KILT_DEVICE_QAIC_SCHEDULER_YIELD_TIME"), -1);
+  const int enqueue_threads =
+      alter_str_i(getconfig_c("KILT_DEVICE_QAIC_ENQUEUE_THREADS"), 0);
 
-  const int enqueue_yield_time =
-      alter_str_i(getconfig_c("KILT_DEVICE_QAIC_ENQUEUE_YIELD_TIME"), -1);
+  // "occupancy" or "round_robin"
+  std::string activation_policy =
+      alter_str(getconfig_c("KILT_DEVICE_QAIC_ACTIVATION_POLICY"),
+                std::string("occupancy"));
 
   const bool qaic_loopback =
       getconfig_opt_b(std::string("KILT_DEVICE_QAIC_LOOPBACK"), false);
+
+  // microseconds per inference
+  const int emulated_latency =
+      alter_str_i(getconfig_c("KILT_DEVICE_QAIC_EMULATED_LATENCY"), 1000);
+
+  // inferences in flight at once, 0 for one per activation
+  const int emulated_concurrency =
+      alter_str_i(getconfig_c("KILT_DEVICE_QAIC_EMULATED_CONCURRENCY"), 0);
 };
 
 IDeviceConfig *getDeviceConfig() { return new QAicDeviceConfig(); }
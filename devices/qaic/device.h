@@ -25,17 +25,17 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
-#include <queue>
-
+#ifdef QAIC_EMULATED
+#include "api/emulated/QAicInfApi.h"
+#else
 #include "api/master/QAicInfApi.h"
+#endif
 #include "config/device_config.h"
 #include "idatasource.h"
 #include "imodel.h"
+#include "payload_ring.h"
 
 //#define NO_QAIC
-//#define ENQUEUE_SHIM_THREADED
-//#define ENQUEUE_SHIM_THREADED_COUNT 2
-#define ENQUEUE_SHIM_THREADED_COUNT 0
 
 using namespace KRAI;
 using namespace qaic_api;
@@ -48,23 +48,24 @@ template <typename Sample> struct Payload {
   int activation;
   int set;
   Device<Sample> *dptr;
+  // when the payload was handed to Enqueue
+  std::chrono::steady_clock::time_point issued;
 };
 
+// Weight of the latest payload in an activation's latency average.
+#define QAIC_LATENCY_EWMA_ALPHA 0.125f
+
+// Payload slots of one activation. getPayload and release are lock-free and
+// may be called from any thread; release wakes the threads waiting on
+// signal.
 template <typename Sample> class RingBuffer {
 
 public:
-  RingBuffer(int d, int a, int s) {
-    size = s;
-    for (int i = 0; i < s; ++i) {
-      auto p = new Payload<Sample>;
-      p->set = i;
-      p->activation = a;
-      p->device = d;
-      q.push(p);
-    }
-  }
+  RingBuffer(int d, int a, int s) : RingBuffer(d, a, s, nullptr) {}
 
-  RingBuffer(int d, int a, int s, Device<Sample> *dptr) {
+  RingBuffer(int d, int a, int s, Device<Sample> *dptr,
+             WakeSignal *signal = nullptr)
+      : q(s), signal(signal) {
     size = s;
     for (int i = 0; i < s; ++i) {
       auto p = new Payload<Sample>;
@@ -77,44 +78,55 @@ public:
   }
 
   virtual ~RingBuffer() {
-    while (!q.empty()) {
-      auto f = q.front();
-      q.pop();
+    Payload<Sample> *f;
+    while (q.pop(f))
       delete f;
-    }
   }
 
   Payload<Sample> *getPayload() {
-    std::unique_lock<std::mutex> lock(mtx);
-    if (q.empty())
-      return nullptr;
-    else {
-      auto f = q.front();
-      q.pop();
-      return f;
-    }
+    Payload<Sample> *p;
+    return q.pop(p) ? p : nullptr;
+  }
+
+  // Free payload slots, a snapshot.
+  int available() const { return q.size(); }
+
+  // All payloads are back, none is queued on the device or postprocessing.
+  bool idle() const { return available() == size; }
+
+  // Exponentially weighted average of the time payloads are out, from
+  // issue to release, in microseconds. 0 until one has come back.
+  float latency() const { return latency_us.load(std::memory_order_relaxed); }
+
+  void recordLatency(float us) {
+    // completions of one activation may race here, losing a sample is fine
+    float l = latency_us.load(std::memory_order_relaxed);
+    l = l == 0.0f ? us : l + QAIC_LATENCY_EWMA_ALPHA * (us - l);
+    latency_us.store(l, std::memory_order_relaxed);
   }
 
   void release(Payload<Sample> *p) {
-    std::unique_lock<std::mutex> lock(mtx);
-    // std::cout << "Release before: " << front << " end: " << end << std::endl;
-    if (q.size() == size || p == nullptr) {
+    if (p == nullptr || !q.push(p)) {
       std::cerr << "extra elem in the queue" << std::endl;
-      // assert(1);
+      return;
     }
-    q.push(p);
-    // std::cout << "Release after: " << front << " end: " << end << std::endl;
-  }
-
-  void debug() {
-    // std::cout << "QUEUE front: " << front << " end: " << end << std::endl;
+    if (signal)
+      signal->notify();
   }
 
 private:
-  std::queue<Payload<Sample> *> q;
+  MPMCQueue<Payload<Sample> *> q;
+  WakeSignal *signal;
   int size;
-  bool isEmpty;
-  std::mutex mtx;
+  std::atomic<float> latency_us{0.0f};
+};
+
+// Hands payloads from the scheduler to one enqueue thread.
+template <typename Sample> struct EnqueueChannel {
+  EnqueueChannel(size_t capacity) : queue(capacity) {}
+
+  SPSCQueue<Payload<Sample> *> queue;
+  WakeSignal signal;
 };
 
 typedef void (*DeviceExec)(void *data);
@@ -133,8 +145,9 @@ public:
     std::vector<int> aff_cpy = aff;
     int device_threads = 0;
 
+    // keep a CPU for the scheduler and one for each enqueue thread
     if (device_cfg->ringfenceDeviceDriver()) {
-      device_threads = 1;
+      device_threads = 1 + device_cfg->getEnqueueThreadCount();
     }
 
     std::cout << "Driver threads: ";
@@ -162,27 +175,38 @@ public:
 
   virtual int Inference(std::vector<Sample> samples) {
 
-    if (sback >= sfront + samples_queue_depth)
+    if (!samples_queue->push(std::move(samples)))
       return -1;
+    wake_signal.notify();
 
-    samples_queue[sback % samples_queue_depth] = samples;
-    ++sback;
-
-    return samples_queue_depth - (sback - sfront);
+    return samples_queue_depth - int(samples_queue->size());
   }
 
   ~Device() {
+    // the scheduler issues the batches still queued before it exits, and
+    // the enqueue threads stay up to run them
     scheduler_terminate = true;
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    wake_signal.notify();
     scheduler.join();
+    delete samples_queue;
 
-#ifdef ENQUEUE_SHIM_THREADED
     shim_terminate = true;
-    for (int i = 0; i < num_setup_threads; ++i)
-      payload_threads[i].join();
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-#endif
+    for (size_t i = 0; i < enqueue_threads.size(); ++i) {
+      enqueue_channels[i]->signal.notify();
+      enqueue_threads[i].join();
+    }
+    for (EnqueueChannel<Sample> *c : enqueue_channels)
+      delete c;
+
+    // the completions and postprocessing tasks of the payloads still out
+    // read the buffers freed with the runner, wait until all are released
+    for (RingBuffer<Sample> *r : ring_buf) {
+      while (!r->idle()) {
+        uint32_t epoch = wake_signal.epoch();
+        if (!r->idle())
+          wake_signal.wait(epoch);
+      }
+    }
 
 #ifndef NO_QAIC
     delete runner;
@@ -204,8 +228,15 @@ private:
 
     samples_queue_depth = device_cfg->getSamplesQueueDepth();
 
-    scheduler_yield_time = device_cfg->getSchedulerYieldTime();
-    enqueue_yield_time = device_cfg->getEnqueueYieldTime();
+    num_enqueue_threads = device_cfg->getEnqueueThreadCount();
+
+    std::string policy = device_cfg->getActivationPolicy();
+    if (policy == "occupancy")
+      occupancy_select = true;
+    else if (policy == "round_robin")
+      occupancy_select = false;
+    else
+      throw "Unknown QAIC activation policy";
 
     loop_back = device_cfg->getLoopback();
 
@@ -219,6 +250,17 @@ private:
     runner->setSetSize(device_cfg->getSetSize());
     runner->setNumThreadsPerQueue(device_cfg->getNumThreadsPerQueue());
     runner->setSkipStage(device_cfg->getSkipStage());
+#ifdef QAIC_EMULATED
+    // the emulated buffers take their sizes from the model's format
+    std::vector<size_t> buffer_sizes;
+    for (int i = 0; i < model_cfg->getInputCount(); ++i)
+      buffer_sizes.push_back(model_cfg->getInputByteSize(i));
+    for (int o = 0; o < model_cfg->getOutputCount(); ++o)
+      buffer_sizes.push_back(model_cfg->getOutputByteSize(o));
+    runner->setBufferSizes(buffer_sizes);
+    runner->setLatency(device_cfg->getEmulatedLatency());
+    runner->setConcurrency(device_cfg->getEmulatedConcurrency());
+#endif
 
     QStatus status = runner->init(hw_id, PostResults);
 
@@ -257,11 +299,16 @@ private:
 
     // populate ring buffer
     for (int a = 0; a < device_cfg->getActivationCount(); ++a)
-      ring_buf[a] =
-          new RingBuffer<Sample>(0, a, device_cfg->getSetSize(), this);
+      ring_buf[a] = new RingBuffer<Sample>(0, a, device_cfg->getSetSize(),
+                                           this, &wake_signal);
 
-    samples_queue.resize(samples_queue_depth);
-    sfront = sback = 0;
+    samples_queue = new MPMCQueue<std::vector<Sample>>(samples_queue_depth);
+
+    // each channel can hold every payload slot of the device
+    shim_terminate = false;
+    for (int i = 0; i < num_enqueue_threads; ++i)
+      enqueue_channels.push_back(new EnqueueChannel<Sample>(
+          device_cfg->getActivationCount() * device_cfg->getSetSize()));
 
     // Kick off the scheduler
     scheduler = std::thread(&Device::QueueScheduler, this);
@@ -280,17 +327,13 @@ private:
 
     aff->pop_back();
 
-#ifdef ENQUEUE_SHIM_THREADED
-    shim_terminate = false;
-
-    num_setup_threads = ENQUEUE_SHIM_THREADED_COUNT;
-
-    payloads.resize(num_setup_threads, nullptr);
+    for (int i = 0; i < num_enqueue_threads; ++i) {
 
-    for (int i = 0; i < num_setup_threads; ++i) {
+      if (aff->empty())
+        throw "Not enough CPUs for the QAIC enqueue threads";
 
       std::cout << "Shim thread " << aff->back() << std::endl;
-      payload_threads.push_back(std::thread(&Device::EnqueueShim, this, i));
+      enqueue_threads.push_back(std::thread(&Device::EnqueueShim, this, i));
 
       // set the affinity of the shim
       cpu_set_t cpu_set;
@@ -300,60 +343,66 @@ private:
 
       CPU_SET(cpu, &cpu_set);
 
-      pthread_setaffinity_np(payload_threads.back().native_handle(),
+      pthread_setaffinity_np(enqueue_threads.back().native_handle(),
                              sizeof(cpu_set_t), &cpu_set);
 
       aff->pop_back();
     }
-
-#else
-    payloads.resize(1, nullptr);
-    shim_terminate = true;
-#endif
   }
 
-  void EnqueueShim(int id) {
+  // Stages the inputs of a payload and issues it to the hardware.
+  void Enqueue(Payload<Sample> *p) {
 
-    do {
-      // std::cout << "Shim " << sched_getcpu() << std::endl;
-      if (payloads[id] != nullptr) {
-        Payload<Sample> *p = payloads[id];
+    p->issued = std::chrono::steady_clock::now();
 
 #ifndef NO_QAIC
-        // set the images
-        if (device_cfg->getInputSelect() == 0) {
-          model->configureWorkload(data_source, &(p->samples),
-                                   buffers_in[p->activation][p->set]);
-        } else if (device_cfg->getInputSelect() == 1) {
-          assert(false);
-          // TODO: We no longer support this as we're copying directly into the
-          // buffer?
-          // void *samples_ptr = session->getSamplePtr(p->samples[0].index);
-          // runner->setBufferPtr(p->activation, p->set, 0, samples_ptr);
-        } else {
-          // Do nothing - random data
-        }
+    // set the images
+    if (device_cfg->getInputSelect() == 0) {
+      model->configureWorkload(data_source, &(p->samples),
+                               buffers_in[p->activation][p->set]);
+    } else if (device_cfg->getInputSelect() == 1) {
+      assert(false);
+      // TODO: We no longer support this as we're copying directly into the
+      // buffer?
+      // void *samples_ptr = session->getSamplePtr(p->samples[0].index);
+      // runner->setBufferPtr(p->activation, p->set, 0, samples_ptr);
+    } else {
+      // Do nothing - random data
+    }
 
-        if (loop_back) {
-          PostResults(NULL, QAIC_EVENT_DEVICE_COMPLETE, p);
-        } else {
-          // std::cout << "Issuing to hardware" << std::endl;
-          QStatus status = runner->run(p->activation, p->set, p);
-          if (status != QS_SUCCESS)
-            throw "Failed to invoke qaic";
-        }
+    if (loop_back) {
+      PostResults(NULL, QAIC_EVENT_DEVICE_COMPLETE, p);
+    } else {
+      // std::cout << "Issuing to hardware" << std::endl;
+      QStatus status = runner->run(p->activation, p->set, p);
+      if (status != QS_SUCCESS)
+        throw "Failed to invoke qaic";
+    }
 #else
-        PostResults(NULL, QAIC_EVENT_DEVICE_COMPLETE, p);
+    PostResults(NULL, QAIC_EVENT_DEVICE_COMPLETE, p);
 #endif
+  }
 
-        payloads[id] = nullptr;
-      } else {
-        if (enqueue_yield_time)
-          std::this_thread::sleep_for(
-              std::chrono::microseconds(enqueue_yield_time));
-      }
+  // Enqueue thread: runs the payloads the scheduler passes on channel id,
+  // sleeping while there are none.
+  void EnqueueShim(int id) {
+
+    EnqueueChannel<Sample> *channel = enqueue_channels[id];
 
-    } while (!shim_terminate);
+    for (;;) {
+      // std::cout << "Shim " << sched_getcpu() << std::endl;
+      uint32_t epoch = channel->signal.epoch();
+      // read before the pop: once set, every payload has been pushed, so
+      // an empty channel then stays empty
+      bool terminating = shim_terminate;
+      Payload<Sample> *p;
+      if (channel->queue.pop(p))
+        Enqueue(p);
+      else if (terminating)
+        break;
+      else
+        channel->signal.wait(epoch);
+    }
   }
 
   void QueueScheduler() {
@@ -361,65 +410,94 @@ private:
     // current activation index
     int activation = -1;
 
-    std::vector<Sample> qs(model_cfg->getBatchSize());
+    // next enqueue thread
+    int round_robin = 0;
 
-    while (!scheduler_terminate) { // loop forever waiting for input
-      // std::cout << "Scheduler " << sched_getcpu() << std::endl;
-      if (sfront == sback) {
-        // No samples then post last results and continue
-        // Device::PostResults(nullptr, QAIC_EVENT_DEVICE_COMPLETE, this);
-        if (scheduler_yield_time)
-          std::this_thread::sleep_for(
-              std::chrono::microseconds(scheduler_yield_time));
+    std::vector<Sample> qs;
 
+    for (;;) { // loop forever waiting for input
+      // std::cout << "Scheduler " << sched_getcpu() << std::endl;
+      // take the next batch off the queue, sleeping until one is pushed.
+      // Once terminating, the batches still queued are issued before
+      // leaving.
+      uint32_t epoch = wake_signal.epoch();
+      // terminate is read after taking the epoch, so the destructor's
+      // notify cannot slip in unnoticed before the wait, and before the
+      // pop, so no batch pushed ahead of it is left behind
+      bool terminating = scheduler_terminate;
+      if (!samples_queue->pop(qs)) {
+        if (terminating)
+          break;
+        wake_signal.wait(epoch);
         continue;
       }
 
-      // copy the image list and remove from queue
-      qs = samples_queue[sfront % samples_queue_depth];
-      ++sfront;
-
       // if(config->getVerbosityServer())
-      //  std::cout << "<" << sback - sfront << ">";
+      //  std::cout << "<" << samples_queue->size() << ">";
 
-      while (!scheduler_terminate) {
+      Payload<Sample> *p = acquirePayload(activation);
 
-        activation = (activation + 1) % device_cfg->getActivationCount();
+      // hand the image samples to the payload
+      p->samples.swap(qs);
 
-        Payload<Sample> *p = ring_buf[activation]->getPayload();
-
-        // if no hardware slots available then increment the activation
-        // count and then continue
-        if (p == nullptr) {
-          if (scheduler_yield_time)
-            std::this_thread::sleep_for(
-                std::chrono::microseconds(scheduler_yield_time));
-          continue;
-        }
-
-        // add the image samples to the payload
-        p->samples = qs;
+      if (num_enqueue_threads == 0) {
+        // no enqueue threads, stage and issue the payload here
+        Enqueue(p);
+        continue;
+      }
 
-#ifdef ENQUEUE_SHIM_THREADED
-        int round_robin = 0;
+      // the channels can hold every payload, so this never has to wait
+      EnqueueChannel<Sample> *channel = enqueue_channels[round_robin];
+      if (!channel->queue.push(p))
+        throw "QAIC enqueue channel overflow";
+      channel->signal.notify();
 
-        while (payloads[round_robin] != nullptr) {
-          std::this_thread::sleep_for(std::chrono::microseconds(1));
-        }
+      // std::cout << " " << round_robin;
+      round_robin = (round_robin + 1) % num_enqueue_threads;
+    }
+    std::cout << "QAIC Device Scheduler terminating..." << std::endl;
+  }
 
-        payloads[round_robin] = p;
+  // Takes a free payload slot and sets activation to the slot's. Sleeps
+  // while all slots are busy; the enqueue threads and the runner outlive
+  // the scheduler, so a busy slot always comes back.
+  Payload<Sample> *acquirePayload(int &activation) {
+    for (;;) {
+      uint32_t epoch = wake_signal.epoch();
+      int a = selectActivation(activation);
+      if (a >= 0) {
+        // only the scheduler takes slots, so a free one stays free
+        activation = a;
+        return ring_buf[a]->getPayload();
+      }
+      wake_signal.wait(epoch);
+    }
+  }
 
-        // std::cout << " " << round_robin;
-        round_robin = (round_robin + 1) % num_setup_threads;
-#else
-        // place the payload in the first slot and call shim directly
-        payloads[0] = p;
-        EnqueueShim(0);
-#endif
-        break;
+  // Picks an activation with a free slot, looking round robin from the one
+  // after last, or returns -1 if there is none. By occupancy, the pick is
+  // the activation whose busy slots are expected to drain first, with ties
+  // going to the earliest in round robin order; otherwise it is simply the
+  // first with a free slot.
+  int selectActivation(int last) {
+    int activations = device_cfg->getActivationCount();
+    int set_size = device_cfg->getSetSize();
+    int best = -1;
+    float best_cost = 0.0f;
+    for (int i = 1; i <= activations; ++i) {
+      int a = (last + i) % activations;
+      int free_sets = ring_buf[a]->available();
+      if (free_sets == 0)
+        continue;
+      if (!occupancy_select)
+        return a;
+      float cost = (set_size - free_sets) * ring_buf[a]->latency();
+      if (best < 0 || cost < best_cost) {
+        best = a;
+        best_cost = cost;
       }
     }
-    std::cout << "QAIC Device Scheduler terminating..." << std::endl;
+    return best;
   }
 
   static void PostResults(QAicEvent *event,
@@ -434,15 +512,24 @@ private:
 
       // p->dptr->mtx_results.lock();
 
-      // get the data from the hardware
-      p->dptr->model->postprocessResults(
-          &(p->samples), p->dptr->buffers_out[p->activation][p->set]);
-
-      p->dptr->ring_buf[p->activation]->release(p);
+      // get the data from the hardware, the payload goes back to the ring
+      // buffer once the model is done with its outputs
+      p->dptr->model->postprocessResultsAsync(
+          &(p->samples), p->dptr->buffers_out[p->activation][p->set], p,
+          ReleasePayload);
       // p->dptr->mtx_results.unlock();
     }
   }
 
+  static void ReleasePayload(void *handle) {
+    Payload<Sample> *p = (Payload<Sample> *)handle;
+    RingBuffer<Sample> *ring = p->dptr->ring_buf[p->activation];
+    ring->recordLatency(std::chrono::duration<float, std::micro>(
+                            std::chrono::steady_clock::now() - p->issued)
+                            .count());
+    ring->release(p);
+  }
+
   virtual void DeviceInitMutex(IModel *_model, IDataSource *_data_source,
                                IConfig *_config, int hw_id,
                                std::vector<int> *aff) {
@@ -459,20 +546,26 @@ private:
   QAicInfApi *runner;
 
   std::vector<RingBuffer<Sample> *> ring_buf;
+  // signalled whenever a batch is queued or a payload slot is released
+  WakeSignal wake_signal;
 
-  std::vector<std::vector<Sample>> samples_queue;
-  std::atomic<int> sfront, sback;
+  // batches waiting for the scheduler, pushed by any number of threads
+  MPMCQueue<std::vector<Sample>> *samples_queue;
   int samples_queue_depth;
 
   std::mutex mtx_queue;
   std::mutex mtx_ringbuf;
 
-  int num_setup_threads;
-  std::vector<Payload<Sample> *> payloads;
-  std::vector<std::thread> payload_threads;
+  // threads staging and issuing payloads, with a channel each; none means
+  // the scheduler does it itself
+  int num_enqueue_threads;
+  // pick activations by occupancy rather than round robin
+  bool occupancy_select;
+  std::vector<EnqueueChannel<Sample> *> enqueue_channels;
+  std::vector<std::thread> enqueue_threads;
 
   std::thread scheduler;
-  bool shim_terminate;
+  std::atomic<bool> shim_terminate;
   std::atomic<bool> scheduler_terminate;
 
   QAicDeviceConfig *device_cfg;
@@ -489,9 +582,6 @@ private:
   IModel *model;
   IDataSource *data_source;
 
-  int scheduler_yield_time;
-  int enqueue_yield_time;
-
   bool loop_back;
 };
 
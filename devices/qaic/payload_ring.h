@@ -0,0 +1,84 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef PAYLOAD_RING_H
+#define PAYLOAD_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include "plugins/work-queue/work_queue.h"
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Each side owns one index and only reads the other's, so neither push nor
+// pop needs a read-modify-write.
+template <typename T> class SPSCQueue {
+public:
+  SPSCQueue(size_t capacity) {
+    // one cell stays empty to tell a full queue from an empty one
+    this->capacity = capacity + 1;
+    cells = new T[this->capacity];
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  ~SPSCQueue() { delete[] cells; }
+
+  // Moves v in, unless the queue is full: then returns false and leaves v
+  // alone.
+  bool push(T &&v) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t next = t + 1 == capacity ? 0 : t + 1;
+    if (next == head.load(std::memory_order_acquire))
+      return false;
+    cells[t] = std::move(v);
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool push(const T &v) {
+    T tmp = v;
+    return push(std::move(tmp));
+  }
+
+  // Moves the oldest element to v, unless the queue is empty: then returns
+  // false.
+  bool pop(T &v) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    v = std::move(cells[h]);
+    head.store(h + 1 == capacity ? 0 : h + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  alignas(WORK_QUEUE_CACHE_LINE) std::atomic<size_t> head;
+  alignas(WORK_QUEUE_CACHE_LINE) std::atomic<size_t> tail;
+  alignas(WORK_QUEUE_CACHE_LINE) T *cells;
+  size_t capacity;
+};
+
+#endif // PAYLOAD_RING_H
@@ -26,6 +26,7 @@
 #define IMODEL_H
 
 #include "idatasource.h"
+#include <chrono>
 
 #define DEBUG(msg) std::cout << "DEBUG: " << msg << std::endl;
 
@@ -33,19 +34,45 @@ namespace KRAI {
 
 class IModel {
 public:
+  // arrival is when the oldest of the samples reached KILT, so models that
+  // hold samples back can bound how long they wait in total.
   virtual void
-  preprocessSamples(IDataSource *data_source, const void *samples, void *handle,
+  preprocessSamples(IDataSource *data_source, const void *samples,
+                    std::chrono::steady_clock::time_point arrival, void *handle,
                     void (*callback)(void *handle, const void *samples)) {
 
     callback(handle, samples);
   }
 
+  // Called periodically by the KILT scheduler so models that hold on to
+  // samples across batches can release them once they are due.
+  virtual void
+  flushSamples(IDataSource *data_source, void *handle,
+               void (*callback)(void *handle, const void *samples)) {}
+
+  // Called once as KILT shuts down, so models that hold on to samples can
+  // release all of them while the devices are still there to run them.
+  virtual void
+  flushAllSamples(IDataSource *data_source, void *handle,
+                  void (*callback)(void *handle, const void *samples)) {}
+
   virtual void configureWorkload(IDataSource *data_source, const void *samples,
                                  std::vector<void *> &in_ptrs) = 0;
 
   virtual void postprocessResults(void *samples,
                                   std::vector<void *> &out_ptrs) = 0;
 
+  // As postprocessResults, but may return before the results are complete.
+  // callback is invoked with handle, possibly from another thread, once
+  // out_ptrs have been consumed and the device may reuse them.
+  virtual void postprocessResultsAsync(void *samples,
+                                       std::vector<void *> &out_ptrs,
+                                       void *handle,
+                                       void (*callback)(void *handle)) {
+    postprocessResults(samples, out_ptrs);
+    callback(handle);
+  }
+
   virtual ~IModel(){};
 };
 
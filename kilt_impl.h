@@ -46,8 +46,6 @@ public:
 
     terminate = false;
 
-    scheduler = std::thread(&KraiInferenceLibrary::Scheduler, this);
-
     model = modelConstruct(config);
 
     for (int ds = 0; ds < config->server_cfg->getDataSourceCount(); ++ds) {
@@ -89,6 +87,9 @@ public:
     batch_trace = std::vector<uint64_t>(config->server_cfg->getBatchSize(), 0);
     distribution =
         std::vector<uint64_t>(config->server_cfg->getDeviceCount(), 0);
+
+    // started last as it calls into the model and data sources
+    scheduler = std::thread(&KraiInferenceLibrary::Scheduler, this);
   }
 
   ~KraiInferenceLibrary() {
@@ -97,6 +98,17 @@ public:
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
     scheduler.join();
 
+    // hand anything still held back to the devices before they go
+    mtx_samples_queue.lock();
+    if (samples_queue.size()) {
+      ++batch_trace[samples_queue.size() - 1];
+      model->preprocessSamples(data_sources[0], &samples_queue, batch_arrival,
+                               this, DispatchImpl);
+      samples_queue.clear();
+    }
+    model->flushAllSamples(data_sources[0], this, DispatchImpl);
+    mtx_samples_queue.unlock();
+
     for (int d = 0; d < config->server_cfg->getDeviceCount(); ++d) {
       delete devices[d];
     }
@@ -148,14 +160,16 @@ public:
 
       mtx_samples_queue.lock();
 
+      if (samples_queue.empty())
+        batch_arrival = std::chrono::steady_clock::now();
       samples_queue.emplace_back(samples[s]);
 
       if (samples_queue.size() == config->server_cfg->getBatchSize()) {
 
         ++batch_trace[samples_queue.size() - 1];
 
-        model->preprocessSamples(data_sources[0], &samples_queue, this,
-                                 DispatchImpl);
+        model->preprocessSamples(data_sources[0], &samples_queue,
+                                 batch_arrival, this, DispatchImpl);
 
         // Dispatch(samples_queue);
         samples_queue.clear();
@@ -278,8 +292,8 @@ private:
 
           ++batch_trace[samples_queue.size() - 1];
           // std::cout << "Timeout triggered." << std::endl;
-          model->preprocessSamples(data_sources[0], &samples_queue, this,
-                                   DispatchImpl);
+          model->preprocessSamples(data_sources[0], &samples_queue,
+                                   batch_arrival, this, DispatchImpl);
           // Dispatch(samples_queue);
           samples_queue.clear();
           prev = now;
@@ -287,6 +301,7 @@ private:
       } else {
         prev = now;
       }
+      model->flushSamples(data_sources[0], this, DispatchImpl);
       mtx_samples_queue.unlock();
       std::this_thread::sleep_for(
           std::chrono::microseconds(scheduler_yield_time));
@@ -308,6 +323,8 @@ private:
   std::vector<Sample> samples_queue;
   std::mutex mtx_samples_queue;
   std::chrono::time_point<std::chrono::steady_clock> prev;
+  // when the first sample of the batch being gathered came in
+  std::chrono::time_point<std::chrono::steady_clock> batch_arrival;
 
   std::atomic<bool> terminate;
   std::thread scheduler;
@@ -0,0 +1,182 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Microbenchmark for the BERT packers over a recorded SQuAD length
+// distribution.
+//
+// Sequence lengths are taken from a tokenized SQuAD input mask file, the one
+// KILT_DATASET_SQUAD_TOKENIZED_INPUT_MASK names: one uint64 per token, one
+// row of seq_len tokens per sample. Batches drawn from those lengths are fed
+// to Packer and StreamingPacker, and the time per sample, pack efficiency and
+// heap allocations made while packing are reported.
+//
+// Build and run, from the repository root:
+//   g++ -std=c++17 -O2 -I. plugins/bert-packing/pack_bench.cpp -o pack_bench
+//   ./pack_bench <input_mask.raw> [seq_len=384] [max_seq_per_pack=3]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "plugins/bert-packing/packer.h"
+
+using namespace KRAI;
+
+// (sample index, sequence length)
+typedef std::pair<int, int> SizedSample;
+
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(size_t size) {
+  ++allocations;
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static std::vector<int> loadLengths(const char *path, int seq_len) {
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    exit(1);
+  }
+  std::vector<uint64_t> row(seq_len);
+  std::vector<int> lengths;
+  while (file.read(reinterpret_cast<char *>(row.data()),
+                   seq_len * sizeof(uint64_t))) {
+    int len = 0;
+    for (int j = 0; j < seq_len; ++j)
+      len += row[j];
+    lengths.push_back(len);
+  }
+  return lengths;
+}
+
+static void noDispatch(void *handle, const void * /*samples*/) {
+  ++*static_cast<uint64_t *>(handle);
+}
+
+static void report(const char *name, int batch, double ns_per_sample,
+                   uint64_t samples, uint64_t packs, uint64_t tokens,
+                   int seq_len, uint64_t allocs) {
+  printf("%-10s batch %4d: %7.1f ns/sample, %5.2f samples/pack, "
+         "efficiency %5.1f%%, %llu allocations\n",
+         name, batch, ns_per_sample, (double)samples / packs,
+         100.0 * tokens / ((double)packs * seq_len),
+         (unsigned long long)allocs);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: %s <input_mask.raw> [seq_len=384] [max_seq_per_pack=3]\n",
+            argv[0]);
+    return 1;
+  }
+  int seq_len = argc > 2 ? atoi(argv[2]) : 384;
+  int max_seq_per_pack = argc > 3 ? atoi(argv[3]) : 3;
+
+  std::vector<int> lengths = loadLengths(argv[1], seq_len);
+  if (lengths.empty()) {
+    fprintf(stderr, "No samples in %s\n", argv[1]);
+    return 1;
+  }
+  printf("%zu samples, seq_len %d, max_seq_per_pack %d\n", lengths.size(),
+         seq_len, max_seq_per_pack);
+
+  const uint64_t samples_per_run = 1 << 20;
+  std::mt19937 rng(0);
+
+  for (int batch : {1, 2, 4, 8, 16, 32, 64, 128, 256}) {
+
+    // draw every batch up front so only the packing is timed
+    int num_batches = samples_per_run / batch;
+    std::vector<std::vector<SizedSample>> batches(num_batches);
+    for (auto &b : batches)
+      for (int s = 0; s < batch; ++s) {
+        int idx = rng() % lengths.size();
+        b.push_back(std::make_pair(idx, lengths[idx]));
+      }
+
+    // warm up once so the packer has seen its largest batch
+    Packer<SizedSample> packer(seq_len, max_seq_per_pack);
+    packer.pack(batches[0]);
+
+    uint64_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &b : batches)
+      packer.pack(b);
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    uint64_t allocs = allocations - before;
+
+    report("Packer", batch, ns / (num_batches * batch),
+           packer.getTotalSamples(), packer.getTotalPacks(),
+           packer.getTotalTokens(), seq_len, allocs);
+
+    // the streaming packer keeps packs open across batches; deadlines are
+    // never reached here, so this shows the efficiency when the wait budget
+    // is long enough to hold packs over from one batch to the next
+    StreamingPacker<SizedSample> stream(seq_len, max_seq_per_pack, 16);
+    auto never = StreamingPacker<SizedSample>::TimePoint::max();
+    uint64_t dispatched = 0;
+    // the open packs carry samples over, so the sets packed vary from call
+    // to call; warm up over a whole run to reach the largest
+    for (auto &b : batches)
+      stream.add(b, never, &dispatched, noDispatch);
+    stream.flushAll(&dispatched, noDispatch);
+    uint64_t warm_samples = stream.getTotalSamples();
+    uint64_t warm_packs = stream.getTotalPacks();
+    uint64_t warm_tokens = stream.getTotalTokens();
+
+    before = allocations;
+    start = std::chrono::steady_clock::now();
+    for (auto &b : batches)
+      stream.add(b, never, &dispatched, noDispatch);
+    ns = std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+             .count();
+    allocs = allocations - before;
+    stream.flushAll(&dispatched, noDispatch);
+
+    report("Streaming", batch, ns / (num_batches * batch),
+           stream.getTotalSamples() - warm_samples,
+           stream.getTotalPacks() - warm_packs,
+           stream.getTotalTokens() - warm_tokens, seq_len, allocs);
+  }
+
+  return 0;
+}
@@ -0,0 +1,201 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef PACKED_INPUTS_H
+#define PACKED_INPUTS_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__amd64__)
+#include <immintrin.h>
+#endif
+
+namespace KRAI {
+
+// Writes one sub-sequence of a packed BERT input in a single pass:
+//   ids[i] = src_ids[i]
+//   seg[i] = src_seg ? src_seg[i] : seg_value   (skipped if seg is null)
+//   pos[i] = i                                  (skipped if pos is null)
+// for i in [0, n). Sources may be wider than the destination, values are
+// narrowed as by static_cast.
+template <typename TDst, typename TSrc>
+static void assemble_sequence_scalar(TDst *ids, TDst *seg, TDst *pos,
+                                     const TSrc *src_ids, const TSrc *src_seg,
+                                     TDst seg_value, int n) {
+  for (int i = 0; i < n; ++i)
+    ids[i] = src_ids[i];
+
+  if (seg != nullptr) {
+    if (src_seg != nullptr)
+      for (int i = 0; i < n; ++i)
+        seg[i] = src_seg[i];
+    else
+      for (int i = 0; i < n; ++i)
+        seg[i] = seg_value;
+  }
+
+  if (pos != nullptr)
+    for (int i = 0; i < n; ++i)
+      pos[i] = i;
+}
+
+#if defined(__amd64__)
+
+// Loads 8 elements of TSrc and returns them at the width of TDst, in one
+// (32-bit) or two (64-bit) registers.
+template <typename TDst, typename TSrc>
+__attribute__((target("avx2"))) static inline void
+load8_avx2(const TSrc *src, __m256i &lo, __m256i &hi) {
+  if constexpr (sizeof(TSrc) == 8 && sizeof(TDst) == 8) {
+    lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4));
+  } else if constexpr (sizeof(TSrc) == 8 && sizeof(TDst) == 4) {
+    // keep the low dword of each qword
+    const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    __m256i a = _mm256_permutevar8x32_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)), idx);
+    __m256i b = _mm256_permutevar8x32_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4)), idx);
+    lo = _mm256_permute2x128_si256(a, b, 0x20);
+  } else { // 32-bit to 32-bit
+    lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+  }
+}
+
+template <typename TDst>
+__attribute__((target("avx2"))) static inline void
+store8_avx2(TDst *dst, __m256i lo, __m256i hi) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), lo);
+  if constexpr (sizeof(TDst) == 8)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4), hi);
+}
+
+template <typename TDst, typename TSrc>
+__attribute__((target("avx2"))) static void
+assemble_sequence_avx2(TDst *ids, TDst *seg, TDst *pos, const TSrc *src_ids,
+                       const TSrc *src_seg, TDst seg_value, int n) {
+
+  __m256i pos_lo, pos_hi, pos_step, seg_fill;
+
+  if constexpr (sizeof(TDst) == 8) {
+    pos_lo = _mm256_setr_epi64x(0, 1, 2, 3);
+    pos_hi = _mm256_setr_epi64x(4, 5, 6, 7);
+    pos_step = _mm256_set1_epi64x(8);
+    seg_fill = _mm256_set1_epi64x(seg_value);
+  } else {
+    pos_lo = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    pos_hi = pos_lo;
+    pos_step = _mm256_set1_epi32(8);
+    seg_fill = _mm256_set1_epi32(seg_value);
+  }
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i lo, hi;
+
+    load8_avx2<TDst>(src_ids + i, lo, hi);
+    store8_avx2(ids + i, lo, hi);
+
+    if (seg != nullptr) {
+      if (src_seg != nullptr) {
+        load8_avx2<TDst>(src_seg + i, lo, hi);
+        store8_avx2(seg + i, lo, hi);
+      } else {
+        store8_avx2(seg + i, seg_fill, seg_fill);
+      }
+    }
+
+    if (pos != nullptr) {
+      store8_avx2(pos + i, pos_lo, pos_hi);
+      if constexpr (sizeof(TDst) == 8) {
+        pos_lo = _mm256_add_epi64(pos_lo, pos_step);
+        pos_hi = _mm256_add_epi64(pos_hi, pos_step);
+      } else {
+        pos_lo = _mm256_add_epi32(pos_lo, pos_step);
+      }
+    }
+  }
+
+  for (; i < n; ++i) {
+    ids[i] = src_ids[i];
+    if (seg != nullptr)
+      seg[i] = (src_seg != nullptr) ? static_cast<TDst>(src_seg[i]) : seg_value;
+    if (pos != nullptr)
+      pos[i] = i;
+  }
+}
+
+#endif
+
+template <typename TDst, typename TSrc> class PackedInputAssembler {
+public:
+  typedef void (*kernel_t)(TDst *, TDst *, TDst *, const TSrc *, const TSrc *,
+                           TDst, int);
+
+  // Picks the widest kernel the CPU supports, once per type pair.
+  static kernel_t kernel() {
+    static const kernel_t k = select();
+    return k;
+  }
+
+private:
+  static kernel_t select() {
+#if defined(__amd64__)
+    constexpr bool supported =
+        std::is_integral<TDst>::value && std::is_integral<TSrc>::value &&
+        (sizeof(TDst) == 4 || sizeof(TDst) == 8) &&
+        (sizeof(TSrc) == sizeof(TDst) || sizeof(TSrc) == 8);
+    if constexpr (supported) {
+      if (__builtin_cpu_supports("avx2"))
+        return assemble_sequence_avx2<TDst, TSrc>;
+    }
+#endif
+    return assemble_sequence_scalar<TDst, TSrc>;
+  }
+};
+
+// Appends a sub-sequence at offset of the packed inputs.
+template <typename TDst, typename TSrc>
+static inline void assemble_sequence(TDst *ids, TDst *seg, TDst *pos,
+                                     unsigned int offset, const TSrc *src_ids,
+                                     const TSrc *src_seg, TDst seg_value,
+                                     int n) {
+  PackedInputAssembler<TDst, TSrc>::kernel()(
+      ids + offset, seg ? seg + offset : nullptr, pos ? pos + offset : nullptr,
+      src_ids, src_seg, seg_value, n);
+}
+
+// Zeroes the unused tail [from, to) of a packed input. Everything before it
+// has just been written, so there is no need to clear the whole buffer.
+template <typename T>
+static inline void clear_tail(T *ptr, unsigned int from, unsigned int to) {
+  if (from < to)
+    memset(ptr + from, 0, (to - from) * sizeof(T));
+}
+
+} // namespace KRAI
+
+#endif // PACKED_INPUTS_H
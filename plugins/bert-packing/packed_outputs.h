@@ -0,0 +1,259 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef PACKED_OUTPUTS_H
+#define PACKED_OUTPUTS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#if defined(__amd64__)
+#include <immintrin.h>
+#endif
+
+#include "../nms-abp/fp16_array.h"
+
+namespace KRAI {
+
+// Marks logits that are half precision floats stored as raw bits.
+struct fp16_bits {
+  uint16_t bits;
+};
+
+template <typename T> static inline float logit_to_float(T v) {
+  return static_cast<float>(v);
+}
+
+static inline const uint16_t *fp16_raw(const fp16_bits *v) {
+  return reinterpret_cast<const uint16_t *>(v);
+}
+
+// Scalar kernels. interleave writes dst[2j] = b0[j], dst[2j+1] = b1[j];
+// convert writes dst[j] = src[j], both for j in [0, n). Half precision is
+// widened with the array conversions.
+template <typename T>
+static void interleave_logits_scalar(float *dst, const T *b0, const T *b1,
+                                     int n) {
+  if constexpr (std::is_same<T, fp16_bits>::value) {
+    float f0[64], f1[64];
+    for (int j = 0; j < n; j += 64) {
+      int m = std::min(64, n - j);
+      fp16_to_fp32_array(f0, fp16_raw(b0 + j), m);
+      fp16_to_fp32_array(f1, fp16_raw(b1 + j), m);
+      interleave_logits_scalar(dst + j * 2, f0, f1, m);
+    }
+  } else {
+    for (int j = 0; j < n; ++j) {
+      dst[j * 2] = logit_to_float(b0[j]);
+      dst[j * 2 + 1] = logit_to_float(b1[j]);
+    }
+  }
+}
+
+template <typename T>
+static void convert_logits_scalar(float *dst, const T *src, int n) {
+  if constexpr (std::is_same<T, float>::value)
+    memcpy(dst, src, n * sizeof(float));
+  else if constexpr (std::is_same<T, fp16_bits>::value)
+    fp16_to_fp32_array(dst, fp16_raw(src), n);
+  else
+    for (int j = 0; j < n; ++j)
+      dst[j] = logit_to_float(src[j]);
+}
+
+#if defined(__amd64__)
+
+// Loads 8 logits as floats.
+template <typename T>
+__attribute__((target("avx2,f16c"))) static inline __m256
+load8_logits_avx2(const T *src) {
+  if constexpr (std::is_same<T, float>::value)
+    return _mm256_loadu_ps(src);
+  else if constexpr (std::is_same<T, uint8_t>::value)
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src))));
+  else // fp16_bits
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+}
+
+template <typename T>
+__attribute__((target("avx2,f16c"))) static void
+interleave_logits_avx2(float *dst, const T *b0, const T *b1, int n) {
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 a = load8_logits_avx2(b0 + j);
+    __m256 b = load8_logits_avx2(b1 + j);
+    // unpack works within 128-bit lanes, the permutes restore the order
+    __m256 lo = _mm256_unpacklo_ps(a, b);
+    __m256 hi = _mm256_unpackhi_ps(a, b);
+    _mm256_storeu_ps(dst + j * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(dst + j * 2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+  }
+  interleave_logits_scalar(dst + j * 2, b0 + j, b1 + j, n - j);
+}
+
+template <typename T>
+__attribute__((target("avx2,f16c"))) static void
+convert_logits_avx2(float *dst, const T *src, int n) {
+  int j = 0;
+  for (; j + 8 <= n; j += 8)
+    _mm256_storeu_ps(dst + j, load8_logits_avx2(src + j));
+  convert_logits_scalar(dst + j, src + j, n - j);
+}
+
+#endif
+
+template <typename T> class LogitsKernels {
+public:
+  typedef void (*interleave_t)(float *, const T *, const T *, int);
+  typedef void (*convert_t)(float *, const T *, int);
+
+  static interleave_t interleave() {
+    static const interleave_t k = simd() ? selectInterleave()
+                                         : interleave_logits_scalar<T>;
+    return k;
+  }
+
+  // half precision is converted by fp16_to_fp32_array, which picks its
+  // own kernel
+  static convert_t convert() {
+    static const convert_t k =
+        simd() && !std::is_same<T, fp16_bits>::value
+            ? selectConvert()
+            : convert_logits_scalar<T>;
+    return k;
+  }
+
+private:
+  static constexpr bool vectorized = std::is_same<T, float>::value ||
+                                     std::is_same<T, uint8_t>::value ||
+                                     std::is_same<T, fp16_bits>::value;
+
+  static bool simd() {
+#if defined(__amd64__)
+    if constexpr (vectorized)
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#endif
+    return false;
+  }
+
+  static interleave_t selectInterleave() {
+#if defined(__amd64__)
+    if constexpr (vectorized)
+      return interleave_logits_avx2<T>;
+#endif
+    return interleave_logits_scalar<T>;
+  }
+
+  static convert_t selectConvert() {
+#if defined(__amd64__)
+    if constexpr (vectorized)
+      return convert_logits_avx2<T>;
+#endif
+    return convert_logits_scalar<T>;
+  }
+};
+
+// Writes the start and end logits of one sample interleaved as floats and
+// pads the result up to result_len floats with pad.
+template <typename T>
+static inline void interleave_logits(float *dst, const T *b0, const T *b1,
+                                     int n, int result_len,
+                                     float pad = -10000.0f) {
+  LogitsKernels<T>::interleave()(dst, b0, b1, n);
+  std::fill(dst + n * 2, dst + result_len, pad);
+}
+
+// Converts already interleaved logits of one sample to floats.
+template <typename T>
+static inline void convert_logits(float *dst, const T *src, int n) {
+  LogitsKernels<T>::convert()(dst, src, n);
+}
+
+// Marks response buffers whose users only need the result storage, e.g.
+// when every result is handed to its own callback.
+struct NoResponse {};
+
+// Result storage for one batch. Buffers only grow, so once warmed up a
+// batch costs no allocations. responses is optional, for users that complete
+// the batch in one call (QuerySamplesComplete); it is cleared by prepare().
+template <typename TResponse> class ResponseBuffer {
+public:
+  float *prepare(int samples, int stride) {
+    if (results.size() < size_t(samples) * stride)
+      results.resize(size_t(samples) * stride);
+    this->stride = stride;
+    responses.clear();
+    return results.data();
+  }
+
+  float *getResult(int i) { return results.data() + size_t(i) * stride; }
+
+  std::vector<TResponse> responses;
+
+private:
+  std::vector<float> results;
+  int stride = 0;
+};
+
+// Pool of response buffers. A buffer must be held until the responses
+// pointing into it have been completed (QuerySamplesComplete or a network
+// callback has returned); it can then be released for the next batch.
+template <typename TResponse> class ResponseArena {
+public:
+  ~ResponseArena() {
+    for (ResponseBuffer<TResponse> *b : buffers)
+      delete b;
+  }
+
+  ResponseBuffer<TResponse> *acquire() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (buffers_free.empty()) {
+      buffers.push_back(new ResponseBuffer<TResponse>());
+      return buffers.back();
+    }
+    ResponseBuffer<TResponse> *tmp = buffers_free.back();
+    buffers_free.pop_back();
+    return tmp;
+  }
+
+  void release(ResponseBuffer<TResponse> *b) {
+    std::unique_lock<std::mutex> lock(mtx);
+    buffers_free.push_back(b);
+  }
+
+private:
+  std::vector<ResponseBuffer<TResponse> *> buffers;
+  std::vector<ResponseBuffer<TResponse> *> buffers_free;
+  std::mutex mtx;
+};
+
+} // namespace KRAI
+
+#endif // PACKED_OUTPUTS_H
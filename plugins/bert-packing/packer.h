@@ -0,0 +1,424 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef PACKER_H
+#define PACKER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Upper bound for the configurable number of sequences in a single pack.
+#define PACK_MAX_SEQ_PER_PACK 16
+
+namespace KRAI {
+
+// Fixed-size pack descriptor. Members are indices into the samples vector
+// handed to Packer::pack().
+struct Pack {
+  int count;
+  int length;
+  int next;
+  int members[PACK_MAX_SEQ_PER_PACK];
+};
+
+// Histogram based worst-fit packer.
+//
+// Sequences are counting-sorted by length and visited longest first. Each one
+// goes into the open pack with the most remaining space, or starts a new pack
+// when nothing can hold it. Open packs are kept in per-remaining-space lists
+// with a bitmask over the non-empty lists, so placing a sequence is O(1).
+//
+// All working memory belongs to the packer and is reused between calls: once
+// it has seen its largest batch, packing does not allocate.
+//
+// TSample is a (sample, length) pair; only the length is looked at.
+template <typename TSample> class Packer {
+public:
+  Packer(int max_seq_len, int max_seq_per_pack);
+
+  // Packs the samples and returns the number of packs produced.
+  int pack(const std::vector<TSample> &samples);
+
+  const Pack &getPack(int idx) const { return packs[idx]; }
+  int getPackCount() const { return pack_count; }
+
+  int getMaxSeqLen() const { return max_seq_len; }
+  int getMaxSeqPerPack() const { return max_seq_per_pack; }
+
+  // Statistics accumulated over every call to pack().
+  uint64_t getTotalSamples() const { return total_samples; }
+  uint64_t getTotalPacks() const { return total_packs; }
+  uint64_t getTotalTokens() const { return total_tokens; }
+
+private:
+  int clampLength(int len) const {
+    return len < 0 ? 0 : (len > max_seq_len ? max_seq_len : len);
+  }
+
+  void pushOpen(int space, int idx);
+  int popOpen(int space);
+  int highestOpen() const;
+
+  const int max_seq_len;
+  const int max_seq_per_pack;
+
+  std::vector<int> histogram;
+  std::vector<int> order;
+  std::vector<Pack> packs;
+  int pack_count;
+
+  // head of the open pack list for each amount of remaining space
+  std::vector<int> open_head;
+  std::vector<uint64_t> open_mask;
+
+  uint64_t total_samples;
+  uint64_t total_packs;
+  uint64_t total_tokens;
+};
+
+// Same signature as the KILT dispatch callback, closed packs are handed
+// straight to it.
+typedef void (*PackCallback)(void *handle, const void *samples);
+
+// Packer that keeps a set of partially filled packs open across calls.
+//
+// Each call packs the new samples together with the members of the packs
+// still open, using the histogram Packer, so a batch packs at least as well
+// as on its own. Packs that are full, or can no longer fit the shortest
+// sequence seen so far, are closed and passed to the callback; the rest stay
+// open. When there are more of those than slots, the fullest are closed, as
+// they have the least to gain from waiting. An open pack is also closed once
+// its oldest member reaches its deadline.
+template <typename TSample> class StreamingPacker {
+public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  StreamingPacker(int max_seq_len, int max_seq_per_pack, int max_open_packs);
+
+  // Adds a batch of sized samples which all expire at `deadline`.
+  void add(const std::vector<TSample> &samples, TimePoint deadline,
+           void *handle, PackCallback callback);
+
+  // Closes every pack whose deadline is at or before `now`.
+  void flush(TimePoint now, void *handle, PackCallback callback);
+
+  // Closes every open pack.
+  void flushAll(void *handle, PackCallback callback);
+
+  bool hasOpenPacks() const { return !open.empty(); }
+  TimePoint getEarliestDeadline() const { return earliest_deadline; }
+
+  uint64_t getTotalSamples() const { return total_samples; }
+  uint64_t getTotalPacks() const { return total_packs; }
+  uint64_t getTotalTokens() const { return total_tokens; }
+
+private:
+  struct Slot {
+    std::vector<TSample> members;
+    std::vector<TimePoint> deadlines;
+    int length;
+    TimePoint deadline;
+  };
+
+  void close(Slot &slot, void *handle, PackCallback callback);
+  void updateEarliestDeadline();
+
+  const int max_seq_len;
+  const int max_seq_per_pack;
+  const size_t max_open_packs;
+
+  Packer<TSample> packer;
+
+  std::vector<Slot> slots;
+  std::vector<int> open;
+  std::vector<int> free_slots;
+  int min_seq_len;
+  TimePoint earliest_deadline;
+
+  // the samples being packed, with their deadlines
+  std::vector<TSample> work;
+  std::vector<TimePoint> work_deadlines;
+  // packs of the current call left underfilled
+  std::vector<int> underfilled;
+
+  uint64_t total_samples;
+  uint64_t total_packs;
+  uint64_t total_tokens;
+};
+
+template <typename TSample>
+Packer<TSample>::Packer(int max_seq_len, int max_seq_per_pack)
+    : max_seq_len(max_seq_len),
+      max_seq_per_pack(std::max(
+          1, std::min(max_seq_per_pack, (int)PACK_MAX_SEQ_PER_PACK))),
+      pack_count(0), total_samples(0), total_packs(0), total_tokens(0) {
+
+  if (max_seq_per_pack > PACK_MAX_SEQ_PER_PACK)
+    std::cerr << "Packer: max_seq_per_pack " << max_seq_per_pack
+              << " clamped to " << PACK_MAX_SEQ_PER_PACK << std::endl;
+
+  histogram.resize(max_seq_len + 1, 0);
+  open_head.resize(max_seq_len + 1, -1);
+  open_mask.resize(max_seq_len / 64 + 1, 0);
+}
+
+template <typename TSample>
+void Packer<TSample>::pushOpen(int space, int idx) {
+  packs[idx].next = open_head[space];
+  open_head[space] = idx;
+  open_mask[space / 64] |= (uint64_t(1) << (space % 64));
+}
+
+template <typename TSample>
+int Packer<TSample>::popOpen(int space) {
+  int idx = open_head[space];
+  open_head[space] = packs[idx].next;
+  if (open_head[space] == -1)
+    open_mask[space / 64] &= ~(uint64_t(1) << (space % 64));
+  return idx;
+}
+
+template <typename TSample>
+int Packer<TSample>::highestOpen() const {
+  for (int w = int(open_mask.size()) - 1; w >= 0; --w) {
+    if (open_mask[w])
+      return w * 64 + 63 - __builtin_clzll(open_mask[w]);
+  }
+  return -1;
+}
+
+template <typename TSample>
+int Packer<TSample>::pack(const std::vector<TSample> &samples) {
+
+  const int num_samples = samples.size();
+
+  if (packs.size() < samples.size()) {
+    packs.resize(num_samples);
+    order.resize(num_samples);
+  }
+
+  // counting sort of the sample indices, longest sequence first
+  std::fill(histogram.begin(), histogram.end(), 0);
+  for (int s = 0; s < num_samples; ++s)
+    ++histogram[clampLength(samples[s].second)];
+
+  int start = 0;
+  for (int l = max_seq_len; l >= 0; --l) {
+    int count = histogram[l];
+    histogram[l] = start;
+    start += count;
+  }
+  for (int s = 0; s < num_samples; ++s)
+    order[histogram[clampLength(samples[s].second)]++] = s;
+
+  pack_count = 0;
+
+  for (int i = 0; i < num_samples; ++i) {
+
+    const int s = order[i];
+    const int len = clampLength(samples[s].second);
+
+    // the open pack with the most room is the only candidate worth checking
+    int idx;
+    int space = highestOpen();
+    if (space >= len) {
+      idx = popOpen(space);
+    } else {
+      idx = pack_count++;
+      packs[idx].count = 0;
+      packs[idx].length = 0;
+    }
+
+    Pack &p = packs[idx];
+    p.members[p.count++] = s;
+    p.length += len;
+
+    int remaining = max_seq_len - p.length;
+    if (remaining > 0 && p.count < max_seq_per_pack)
+      pushOpen(remaining, idx);
+
+    total_tokens += len;
+  }
+
+  // drop the packs left open
+  std::fill(open_head.begin(), open_head.end(), -1);
+  std::fill(open_mask.begin(), open_mask.end(), 0);
+
+  total_samples += num_samples;
+  total_packs += pack_count;
+
+  return pack_count;
+}
+
+template <typename TSample>
+StreamingPacker<TSample>::StreamingPacker(int max_seq_len,
+                                          int max_seq_per_pack,
+                                          int max_open_packs)
+    : max_seq_len(max_seq_len),
+      max_seq_per_pack(std::max(
+          1, std::min(max_seq_per_pack, (int)PACK_MAX_SEQ_PER_PACK))),
+      max_open_packs(std::max(1, max_open_packs)),
+      packer(max_seq_len, max_seq_per_pack), min_seq_len(max_seq_len),
+      earliest_deadline(TimePoint::max()), total_samples(0), total_packs(0),
+      total_tokens(0) {
+
+  // one slot more than may stay open, for the pack being placed
+  slots.resize(this->max_open_packs + 1);
+  for (size_t i = slots.size(); i-- > 0;) {
+    slots[i].members.reserve(this->max_seq_per_pack);
+    slots[i].deadlines.reserve(this->max_seq_per_pack);
+    free_slots.push_back(i);
+  }
+  open.reserve(slots.size());
+  underfilled.reserve(slots.size());
+}
+
+template <typename TSample>
+void StreamingPacker<TSample>::updateEarliestDeadline() {
+  earliest_deadline = TimePoint::max();
+  for (int idx : open)
+    earliest_deadline = std::min(earliest_deadline, slots[idx].deadline);
+}
+
+template <typename TSample>
+void StreamingPacker<TSample>::close(Slot &slot, void *handle,
+                                     PackCallback callback) {
+  total_samples += slot.members.size();
+  total_packs += 1;
+  total_tokens += slot.length;
+
+  callback(handle, &slot.members);
+}
+
+template <typename TSample>
+void StreamingPacker<TSample>::add(const std::vector<TSample> &samples,
+                                   TimePoint deadline, void *handle,
+                                   PackCallback callback) {
+
+  // take the members of the open packs back to be packed again
+  work.clear();
+  work_deadlines.clear();
+  for (int idx : open) {
+    Slot &slot = slots[idx];
+    work.insert(work.end(), slot.members.begin(), slot.members.end());
+    work_deadlines.insert(work_deadlines.end(), slot.deadlines.begin(),
+                          slot.deadlines.end());
+    free_slots.push_back(idx);
+  }
+  open.clear();
+
+  for (const TSample &sample : samples) {
+    int len = std::min(sample.second, max_seq_len);
+    if (len > 0 && len < min_seq_len)
+      min_seq_len = len;
+    work.push_back(sample);
+    work_deadlines.push_back(deadline);
+  }
+
+  int pack_count = packer.pack(work);
+
+  // close the packs nothing seen so far can be added to, and set the others
+  // up in slots; more than there are slots get closed below
+  underfilled.clear();
+  for (int ps = 0; ps < pack_count; ++ps) {
+    const Pack &p = packer.getPack(ps);
+    Slot &slot = slots[free_slots.back()];
+
+    slot.members.clear();
+    slot.deadlines.clear();
+    slot.length = p.length;
+    slot.deadline = TimePoint::max();
+    for (int m = 0; m < p.count; ++m) {
+      slot.members.push_back(work[p.members[m]]);
+      slot.deadlines.push_back(work_deadlines[p.members[m]]);
+      slot.deadline = std::min(slot.deadline, work_deadlines[p.members[m]]);
+    }
+
+    if (max_seq_len - p.length < std::max(min_seq_len, 1) ||
+        p.count >= max_seq_per_pack) {
+      close(slot, handle, callback);
+      continue;
+    }
+
+    int idx = free_slots.back();
+    free_slots.pop_back();
+    underfilled.push_back(idx);
+
+    // more underfilled packs than may stay open, close the fullest
+    if (free_slots.empty()) {
+      auto fullest = std::max_element(
+          underfilled.begin(), underfilled.end(),
+          [this](int x, int y) { return slots[x].length < slots[y].length; });
+      close(slots[*fullest], handle, callback);
+      free_slots.push_back(*fullest);
+      *fullest = underfilled.back();
+      underfilled.pop_back();
+    }
+  }
+
+  open.swap(underfilled);
+  updateEarliestDeadline();
+}
+
+template <typename TSample>
+void StreamingPacker<TSample>::flush(TimePoint now, void *handle,
+                                     PackCallback callback) {
+
+  if (open.empty() || now < earliest_deadline)
+    return;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < open.size(); ++i) {
+    int idx = open[i];
+    if (slots[idx].deadline <= now) {
+      close(slots[idx], handle, callback);
+      free_slots.push_back(idx);
+    } else {
+      open[kept++] = idx;
+    }
+  }
+  open.resize(kept);
+
+  updateEarliestDeadline();
+}
+
+template <typename TSample>
+void StreamingPacker<TSample>::flushAll(void *handle,
+                                        PackCallback callback) {
+
+  for (int idx : open) {
+    close(slots[idx], handle, callback);
+    free_slots.push_back(idx);
+  }
+  open.clear();
+
+  earliest_deadline = TimePoint::max();
+}
+
+} // namespace KRAI
+
+#endif // PACKER_H
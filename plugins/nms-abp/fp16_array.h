@@ -0,0 +1,248 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef FP16_ARRAY_H
+#define FP16_ARRAY_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__amd64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "fp16.h"
+
+// Array conversions between float and the 16-bit float formats: IEEE half
+// precision (fp16) and bfloat16 (bf16, the upper half of a float). Widening
+// multiplies every value by scale on the way. Narrowing rounds to nearest
+// even.
+//
+// All versions agree bit for bit with the scalar conversions for every input
+// but NaN, which only stays NaN.
+
+static inline float bf16_to_fp32_value(uint16_t h) {
+  return fp32_from_bits(uint32_t(h) << 16);
+}
+
+static inline uint16_t bf16_from_fp32_value(float f) {
+  uint32_t w = fp32_to_bits(f);
+  if ((w & 0x7fffffffu) > 0x7f800000u) // NaN, kept quiet
+    return uint16_t((w | 0x400000u) >> 16);
+  return uint16_t((w + 0x7fffu + ((w >> 16) & 1)) >> 16);
+}
+
+static void fp16_to_fp32_scalar(float *dst, const uint16_t *src, size_t n,
+                                float scale) {
+  for (size_t i = 0; i < n; ++i)
+    dst[i] = fp16_ieee_to_fp32_value(src[i]) * scale;
+}
+
+static void fp32_to_fp16_scalar(uint16_t *dst, const float *src, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    dst[i] = fp16_ieee_from_fp32_value(src[i]);
+}
+
+static void bf16_to_fp32_scalar(float *dst, const uint16_t *src, size_t n,
+                                float scale) {
+  for (size_t i = 0; i < n; ++i)
+    dst[i] = bf16_to_fp32_value(src[i]) * scale;
+}
+
+static void fp32_to_bf16_scalar(uint16_t *dst, const float *src, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    dst[i] = bf16_from_fp32_value(src[i]);
+}
+
+#if defined(__amd64__)
+
+__attribute__((target("avx2,f16c"))) static void
+fp16_to_fp32_avx2(float *dst, const uint16_t *src, size_t n, float scale) {
+  const __m256 s = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtph_ps(h), s));
+  }
+  fp16_to_fp32_scalar(dst + i, src + i, n - i, scale);
+}
+
+__attribute__((target("avx2,f16c"))) static void
+fp32_to_fp16_avx2(uint16_t *dst, const float *src, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), h);
+  }
+  fp32_to_fp16_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+bf16_to_fp32_avx2(float *dst, const uint16_t *src, size_t n, float scale) {
+  const __m256 s = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m256i w = _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16);
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_castsi256_ps(w), s));
+  }
+  bf16_to_fp32_scalar(dst + i, src + i, n - i, scale);
+}
+
+__attribute__((target("avx2"))) static void
+fp32_to_bf16_avx2(uint16_t *dst, const float *src, size_t n) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i bias = _mm256_set1_epi32(0x7fff);
+  const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+  const __m256i inf = _mm256_set1_epi32(0x7f800000);
+  const __m256i quiet = _mm256_set1_epi32(0x400000);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i w = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(w, 16), one);
+    __m256i r = _mm256_add_epi32(_mm256_add_epi32(w, bias), lsb);
+    __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(w, abs_mask), inf);
+    r = _mm256_blendv_epi8(r, _mm256_or_si256(w, quiet), nan);
+    r = _mm256_srli_epi32(r, 16);
+    // packus works within 128-bit lanes, the permute restores the order
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xd8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm256_castsi256_si128(r));
+  }
+  fp32_to_bf16_scalar(dst + i, src + i, n - i);
+}
+
+#elif defined(__aarch64__)
+
+static void fp16_to_fp32_neon(float *dst, const uint16_t *src, size_t n,
+                              float scale) {
+  const float32x4_t s = vdupq_n_f32(scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(src + i));
+    vst1q_f32(dst + i, vmulq_f32(vcvt_f32_f16(vget_low_f16(h)), s));
+    vst1q_f32(dst + i + 4, vmulq_f32(vcvt_high_f32_f16(h), s));
+  }
+  fp16_to_fp32_scalar(dst + i, src + i, n - i, scale);
+}
+
+static void fp32_to_fp16_neon(uint16_t *dst, const float *src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    vst1_u16(dst + i,
+             vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+  fp32_to_fp16_scalar(dst + i, src + i, n - i);
+}
+
+static void bf16_to_fp32_neon(float *dst, const uint16_t *src, size_t n,
+                              float scale) {
+  const float32x4_t s = vdupq_n_f32(scale);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32x4_t w = vshll_n_u16(vld1_u16(src + i), 16);
+    vst1q_f32(dst + i, vmulq_f32(vreinterpretq_f32_u32(w), s));
+  }
+  bf16_to_fp32_scalar(dst + i, src + i, n - i, scale);
+}
+
+static void fp32_to_bf16_neon(uint16_t *dst, const float *src, size_t n) {
+  const uint32x4_t one = vdupq_n_u32(1);
+  const uint32x4_t bias = vdupq_n_u32(0x7fff);
+  const uint32x4_t abs_mask = vdupq_n_u32(0x7fffffff);
+  const uint32x4_t inf = vdupq_n_u32(0x7f800000);
+  const uint32x4_t quiet = vdupq_n_u32(0x400000);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32x4_t w = vreinterpretq_u32_f32(vld1q_f32(src + i));
+    uint32x4_t lsb = vandq_u32(vshrq_n_u32(w, 16), one);
+    uint32x4_t r = vaddq_u32(vaddq_u32(w, bias), lsb);
+    uint32x4_t nan = vcgtq_u32(vandq_u32(w, abs_mask), inf);
+    r = vbslq_u32(nan, vorrq_u32(w, quiet), r);
+    vst1_u16(dst + i, vshrn_n_u32(r, 16));
+  }
+  fp32_to_bf16_scalar(dst + i, src + i, n - i);
+}
+
+#endif
+
+// The conversion kernels for this CPU, picked on first use.
+class Fp16ArrayKernels {
+public:
+  typedef void (*widen_t)(float *, const uint16_t *, size_t, float);
+  typedef void (*narrow_t)(uint16_t *, const float *, size_t);
+
+  widen_t fp16_to_fp32 = fp16_to_fp32_scalar;
+  narrow_t fp32_to_fp16 = fp32_to_fp16_scalar;
+  widen_t bf16_to_fp32 = bf16_to_fp32_scalar;
+  narrow_t fp32_to_bf16 = fp32_to_bf16_scalar;
+
+  static const Fp16ArrayKernels &get() {
+    static const Fp16ArrayKernels k;
+    return k;
+  }
+
+private:
+  Fp16ArrayKernels() {
+#if defined(__amd64__)
+    if (__builtin_cpu_supports("avx2")) {
+      bf16_to_fp32 = bf16_to_fp32_avx2;
+      fp32_to_bf16 = fp32_to_bf16_avx2;
+      if (__builtin_cpu_supports("f16c")) {
+        fp16_to_fp32 = fp16_to_fp32_avx2;
+        fp32_to_fp16 = fp32_to_fp16_avx2;
+      }
+    }
+#elif defined(__aarch64__)
+    fp16_to_fp32 = fp16_to_fp32_neon;
+    fp32_to_fp16 = fp32_to_fp16_neon;
+    bf16_to_fp32 = bf16_to_fp32_neon;
+    fp32_to_bf16 = fp32_to_bf16_neon;
+#endif
+  }
+};
+
+static inline void fp16_to_fp32_array(float *dst, const uint16_t *src,
+                                      size_t n, float scale = 1.0f) {
+  Fp16ArrayKernels::get().fp16_to_fp32(dst, src, n, scale);
+}
+
+static inline void fp32_to_fp16_array(uint16_t *dst, const float *src,
+                                      size_t n) {
+  Fp16ArrayKernels::get().fp32_to_fp16(dst, src, n);
+}
+
+static inline void bf16_to_fp32_array(float *dst, const uint16_t *src,
+                                      size_t n, float scale = 1.0f) {
+  Fp16ArrayKernels::get().bf16_to_fp32(dst, src, n, scale);
+}
+
+static inline void fp32_to_bf16_array(uint16_t *dst, const float *src,
+                                      size_t n) {
+  Fp16ArrayKernels::get().fp32_to_bf16(dst, src, n);
+}
+
+#endif // FP16_ARRAY_H
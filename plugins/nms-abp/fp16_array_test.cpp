@@ -0,0 +1,184 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Exhaustive check of the fp16/bf16 array conversions in fp16_array.h.
+//
+// The kernels picked for this CPU are compared with the scalar conversions
+// on all 65536 16-bit inputs when widening, with and without a scale, and
+// when narrowing on every value of both formats together with the floats
+// on and next to each rounding boundary between two neighbouring values.
+// Results must agree bit for bit, except that a NaN only has to stay NaN.
+// Every length up to 40 is also run at each alignment to cover the tails.
+//
+// Build and run, from the repository root:
+//   g++ -std=c++17 -O2 -I. plugins/nms-abp/fp16_array_test.cpp -o fp16_test
+//   ./fp16_test
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "plugins/nms-abp/fp16_array.h"
+
+static bool isNaN16(uint16_t h, bool bf16) {
+  return bf16 ? (h & 0x7fffu) > 0x7f80u : (h & 0x7fffu) > 0x7c00u;
+}
+
+static bool same(float a, float b) {
+  return fp32_to_bits(a) == fp32_to_bits(b) || (std::isnan(a) && std::isnan(b));
+}
+
+static bool same(uint16_t a, uint16_t b, bool bf16) {
+  return a == b || (isNaN16(a, bf16) && isNaN16(b, bf16));
+}
+
+static int checkWiden(const char *name, Fp16ArrayKernels::widen_t kernel,
+                      Fp16ArrayKernels::widen_t scalar, float scale) {
+  std::vector<uint16_t> src(65536);
+  for (size_t i = 0; i < src.size(); ++i)
+    src[i] = uint16_t(i);
+  std::vector<float> got(src.size()), want(src.size());
+  kernel(got.data(), src.data(), src.size(), scale);
+  scalar(want.data(), src.data(), src.size(), scale);
+
+  int bad = 0;
+  for (size_t i = 0; i < src.size(); ++i) {
+    if (!same(got[i], want[i])) {
+      if (bad++ < 8)
+        printf("  %s 0x%04zx scale %g: %a, expected %a\n", name, i, scale,
+               got[i], want[i]);
+    }
+  }
+  printf("%s, scale %g: %zu inputs, %d mismatches\n", name, scale,
+         src.size(), bad);
+  return bad;
+}
+
+// Every value the format holds and, between each two neighbouring values,
+// the midpoint and the floats either side of it.
+static std::vector<float> narrowingInputs(bool bf16) {
+  std::vector<float> in;
+  for (uint32_t s = 0; s < 2; ++s) {
+    uint32_t top = bf16 ? 0x7f80u : 0x7c00u; // +inf
+    for (uint32_t h = 0; h <= top; ++h) {
+      uint16_t a = uint16_t((s << 15) | h);
+      float fa = bf16 ? bf16_to_fp32_value(a) : fp16_ieee_to_fp32_value(a);
+      in.push_back(fa);
+      if (h == top)
+        break;
+      // the pattern after the largest finite value stands for the next
+      // power of two, halfway to it is where rounding overflows
+      double fb = h + 1 < top ? double(bf16 ? bf16_to_fp32_value(a + 1)
+                                            : fp16_ieee_to_fp32_value(a + 1))
+                              : ldexp(1.0, bf16 ? 128 : 16);
+      // both are exact in double, so is the midpoint
+      float mid = float((double(fa) + fb) / 2.0);
+      in.push_back(mid);
+      in.push_back(nextafterf(mid, 0.0f));
+      in.push_back(nextafterf(mid, s ? -INFINITY : INFINITY));
+    }
+  }
+  // the largest floats, and NaNs
+  for (float f : {3.4028235e38f, -3.4028235e38f, NAN, -NAN,
+                  fp32_from_bits(0x7f800001u), fp32_from_bits(0xffc00001u)})
+    in.push_back(f);
+  return in;
+}
+
+static int checkNarrow(const char *name, Fp16ArrayKernels::narrow_t kernel,
+                       Fp16ArrayKernels::narrow_t scalar, bool bf16) {
+  std::vector<float> src = narrowingInputs(bf16);
+  std::vector<uint16_t> got(src.size()), want(src.size());
+  kernel(got.data(), src.data(), src.size());
+  scalar(want.data(), src.data(), src.size());
+
+  int bad = 0;
+  for (size_t i = 0; i < src.size(); ++i) {
+    if (!same(got[i], want[i], bf16)) {
+      if (bad++ < 8)
+        printf("  %s %a: 0x%04x, expected 0x%04x\n", name, src[i], got[i],
+               want[i]);
+    }
+  }
+  printf("%s: %zu inputs, %d mismatches\n", name, src.size(), bad);
+  return bad;
+}
+
+// Short and unaligned runs, which go through the scalar tails.
+static int checkTails(const Fp16ArrayKernels &k) {
+  const int max_len = 40;
+  const int max_off = 8;
+  std::vector<uint16_t> h(max_len + max_off), hout(max_len + max_off);
+  std::vector<float> f(max_len + max_off), fout(max_len + max_off);
+  for (size_t i = 0; i < h.size(); ++i) {
+    h[i] = uint16_t(0x3c00u + 37u * i);
+    f[i] = 1.0f + 0.3f * float(i);
+  }
+
+  int bad = 0;
+  for (int off = 0; off < max_off; ++off) {
+    for (int n = 0; n <= max_len; ++n) {
+      // guard values past the end must be left alone
+      for (int j = 0; j < max_len + max_off; ++j) {
+        fout[j] = -1.0f;
+        hout[j] = 0xffffu;
+      }
+      k.fp16_to_fp32(fout.data() + off, h.data() + off, n, 2.0f);
+      for (int j = 0; j < max_len + max_off; ++j) {
+        bool in = j >= off && j < off + n;
+        float want = in ? fp16_ieee_to_fp32_value(h[j]) * 2.0f : -1.0f;
+        bad += !same(fout[j], want);
+      }
+      k.fp32_to_bf16(hout.data() + off, f.data() + off, n);
+      for (int j = 0; j < max_len + max_off; ++j) {
+        bool in = j >= off && j < off + n;
+        uint16_t want = in ? bf16_from_fp32_value(f[j]) : 0xffffu;
+        bad += !same(hout[j], want, true);
+      }
+    }
+  }
+  printf("lengths 0..%d at offsets 0..%d: %d mismatches\n", max_len,
+         max_off - 1, bad);
+  return bad;
+}
+
+int main() {
+  const Fp16ArrayKernels &k = Fp16ArrayKernels::get();
+
+  int bad = 0;
+  for (float scale : {1.0f, 0.00392156886f}) {
+    bad += checkWiden("fp16 to fp32", k.fp16_to_fp32, fp16_to_fp32_scalar,
+                      scale);
+    bad += checkWiden("bf16 to fp32", k.bf16_to_fp32, bf16_to_fp32_scalar,
+                      scale);
+  }
+  bad += checkNarrow("fp32 to fp16", k.fp32_to_fp16, fp32_to_fp16_scalar,
+                     false);
+  bad += checkNarrow("fp32 to bf16", k.fp32_to_bf16, fp32_to_bf16_scalar,
+                     true);
+  bad += checkTails(k);
+
+  printf(bad ? "FAILED\n" : "PASSED\n");
+  return bad ? 1 : 0;
+}
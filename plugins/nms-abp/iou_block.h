@@ -0,0 +1,173 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef IOU_BLOCK_H
+#define IOU_BLOCK_H
+
+#include <cstdint>
+
+#if defined(__amd64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Candidates per IoU block.
+#define NMS_IOU_BLOCK 8
+
+// A block of candidate boxes in structure-of-arrays layout. Unused lanes
+// must hold empty boxes, which overlap nothing.
+struct IouBlock {
+  alignas(32) float y1[NMS_IOU_BLOCK];
+  alignas(32) float x1[NMS_IOU_BLOCK];
+  alignas(32) float y2[NMS_IOU_BLOCK];
+  alignas(32) float x2[NMS_IOU_BLOCK];
+};
+
+// Bit j of the result is set if the IoU of candidate j with box
+// {y1, x1, y2, x2} is above thres. The IoU is evaluated with exactly the
+// operations of NMS_ABP::computeIOU, so all versions agree bit for bit.
+static inline uint32_t iou_above_scalar(const IouBlock &b, float y1, float x1,
+                                        float y2, float x2, float thres) {
+  uint32_t mask = 0;
+  float area2 = (y2 - y1) * (x2 - x1);
+  for (int j = 0; j < NMS_IOU_BLOCK; ++j) {
+    float inter_y1 = b.y1[j] < y1 ? y1 : b.y1[j];
+    float inter_x1 = b.x1[j] < x1 ? x1 : b.x1[j];
+    float inter_y2 = y2 < b.y2[j] ? y2 : b.y2[j];
+    float inter_x2 = x2 < b.x2[j] ? x2 : b.x2[j];
+    if ((inter_y1 < inter_y2) && (inter_x1 < inter_x2)) {
+      float intersect = (inter_y2 - inter_y1) * (inter_x2 - inter_x1);
+      float total =
+          (b.y2[j] - b.y1[j]) * (b.x2[j] - b.x1[j]) + area2 - intersect;
+      float iou = total > 0.0f ? (intersect / total) : 0.0f;
+      if (iou > thres)
+        mask |= 1u << j;
+    }
+  }
+  return mask;
+}
+
+#if defined(__amd64__)
+
+__attribute__((target("avx2"))) static uint32_t
+iou_above_avx2(const IouBlock &b, float y1, float x1, float y2, float x2,
+               float thres) {
+  __m256 by1 = _mm256_load_ps(b.y1);
+  __m256 bx1 = _mm256_load_ps(b.x1);
+  __m256 by2 = _mm256_load_ps(b.y2);
+  __m256 bx2 = _mm256_load_ps(b.x2);
+
+  __m256 sy1 = _mm256_set1_ps(y1);
+  __m256 sx1 = _mm256_set1_ps(x1);
+  __m256 sy2 = _mm256_set1_ps(y2);
+  __m256 sx2 = _mm256_set1_ps(x2);
+  __m256 area2 = _mm256_set1_ps((y2 - y1) * (x2 - x1));
+
+  // operand order matches std::max and std::min on ties
+  __m256 inter_y1 = _mm256_max_ps(sy1, by1);
+  __m256 inter_x1 = _mm256_max_ps(sx1, bx1);
+  __m256 inter_y2 = _mm256_min_ps(sy2, by2);
+  __m256 inter_x2 = _mm256_min_ps(sx2, bx2);
+
+  __m256 valid =
+      _mm256_and_ps(_mm256_cmp_ps(inter_y1, inter_y2, _CMP_LT_OQ),
+                    _mm256_cmp_ps(inter_x1, inter_x2, _CMP_LT_OQ));
+  __m256 intersect = _mm256_mul_ps(_mm256_sub_ps(inter_y2, inter_y1),
+                                   _mm256_sub_ps(inter_x2, inter_x1));
+  __m256 area1 =
+      _mm256_mul_ps(_mm256_sub_ps(by2, by1), _mm256_sub_ps(bx2, bx1));
+  __m256 total = _mm256_sub_ps(_mm256_add_ps(area1, area2), intersect);
+  valid = _mm256_and_ps(
+      valid, _mm256_cmp_ps(total, _mm256_setzero_ps(), _CMP_GT_OQ));
+  __m256 iou = _mm256_div_ps(intersect, total);
+  valid = _mm256_and_ps(
+      valid, _mm256_cmp_ps(iou, _mm256_set1_ps(thres), _CMP_GT_OQ));
+
+  return _mm256_movemask_ps(valid);
+}
+
+#elif defined(__aarch64__)
+
+static uint32_t iou_above_neon(const IouBlock &b, float y1, float x1,
+                               float y2, float x2, float thres) {
+  static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+  uint32x4_t bits = vld1q_u32(lane_bits);
+
+  float32x4_t sy1 = vdupq_n_f32(y1);
+  float32x4_t sx1 = vdupq_n_f32(x1);
+  float32x4_t sy2 = vdupq_n_f32(y2);
+  float32x4_t sx2 = vdupq_n_f32(x2);
+  float32x4_t area2 = vdupq_n_f32((y2 - y1) * (x2 - x1));
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  float32x4_t th = vdupq_n_f32(thres);
+
+  uint32_t mask = 0;
+  for (int q = 0; q < NMS_IOU_BLOCK; q += 4) {
+    float32x4_t by1 = vld1q_f32(b.y1 + q);
+    float32x4_t bx1 = vld1q_f32(b.x1 + q);
+    float32x4_t by2 = vld1q_f32(b.y2 + q);
+    float32x4_t bx2 = vld1q_f32(b.x2 + q);
+
+    // the sign of a zero picked on ties cannot change the outcome
+    float32x4_t inter_y1 = vmaxq_f32(sy1, by1);
+    float32x4_t inter_x1 = vmaxq_f32(sx1, bx1);
+    float32x4_t inter_y2 = vminq_f32(sy2, by2);
+    float32x4_t inter_x2 = vminq_f32(sx2, bx2);
+
+    uint32x4_t valid = vandq_u32(vcltq_f32(inter_y1, inter_y2),
+                                 vcltq_f32(inter_x1, inter_x2));
+    float32x4_t intersect = vmulq_f32(vsubq_f32(inter_y2, inter_y1),
+                                      vsubq_f32(inter_x2, inter_x1));
+    float32x4_t area1 =
+        vmulq_f32(vsubq_f32(by2, by1), vsubq_f32(bx2, bx1));
+    float32x4_t total = vsubq_f32(vaddq_f32(area1, area2), intersect);
+    valid = vandq_u32(valid, vcgtq_f32(total, zero));
+    float32x4_t iou = vdivq_f32(intersect, total);
+    valid = vandq_u32(valid, vcgtq_f32(iou, th));
+
+    mask |= vaddvq_u32(vandq_u32(valid, bits)) << q;
+  }
+  return mask;
+}
+
+#endif
+
+static inline uint32_t iou_above(const IouBlock &b, float y1, float x1,
+                                 float y2, float x2, float thres) {
+#if defined(__amd64__)
+  typedef uint32_t (*kernel_t)(const IouBlock &, float, float, float, float,
+                               float);
+  static const kernel_t k = __builtin_cpu_supports("avx2")
+                                ? iou_above_avx2
+                                : iou_above_scalar;
+  return k(b, y1, x1, y2, x2, thres);
+#elif defined(__aarch64__)
+  return iou_above_neon(b, y1, x1, y2, x2, thres);
+#else
+  return iou_above_scalar(b, y1, x1, y2, x2, thres);
+#endif
+}
+
+#endif // IOU_BLOCK_H
@@ -24,15 +24,112 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <math.h>
+#include <numeric>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <type_traits>
+#include <vector>
 
 #include "nms_abp_config.h"
 
 #include "fp16.h"
+#include "iou_block.h"
+#include "score_order.h"
+#include "threshold_scan.h"
+
+// Boxes per threshold scan of a box-major confidence tensor.
+#define NMS_SCAN_CHUNK_BOXES 256
+
+// Candidate boxes of one class in structure-of-arrays layout. Storage only
+// grows, so a reused instance stops allocating once it has warmed up.
+class CandidateBoxes {
+public:
+  void clear() {
+    y1.clear();
+    x1.clear();
+    y2.clear();
+    x2.clear();
+    score.clear();
+    key.clear();
+  }
+
+  int size() const { return score.size(); }
+
+  void push(float by1, float bx1, float by2, float bx2, float s,
+            uint16_t k) {
+    y1.push_back(by1);
+    x1.push_back(bx1);
+    y2.push_back(by2);
+    x2.push_back(bx2);
+    score.push_back(s);
+    key.push_back(k);
+  }
+
+  std::vector<float> y1, x1, y2, x2, score;
+  // raw quantized score, ordered like score (see NMS_ABP::scoreKey)
+  std::vector<uint16_t> key;
+};
+
+// Scratch memory of NMS_ABP for one image at a time. Each worker thread
+// must use its own workspace.
+class NMSWorkspace {
+public:
+  NMSWorkspace(int num_classes) : candidates(num_classes) {}
+
+  void reset() { selectedAll.clear(); }
+
+  // Starts a new image, invalidating all decoded boxes.
+  void beginImage(int num_boxes) {
+    if (decoded_stamp.size() < num_boxes) {
+      decoded_stamp.resize(num_boxes, 0);
+      decoded.resize(num_boxes * NUM_COORDINATES);
+    }
+    if (++generation == 0) {
+      std::fill(decoded_stamp.begin(), decoded_stamp.end(), 0);
+      generation = 1;
+    }
+  }
+
+  // Storage for decoded box bi of the image. fresh is set if the box has
+  // not been decoded into it yet.
+  float *decodedBox(uint32_t bi, bool &fresh) {
+    fresh = decoded_stamp[bi] != generation;
+    decoded_stamp[bi] = generation;
+    return &decoded[bi * NUM_COORDINATES];
+  }
+
+  // candidates per class
+  std::vector<CandidateBoxes> candidates;
+  // boxes kept so far for the class being suppressed
+  CandidateBoxes selected;
+  // candidate indices ordered by score
+  std::vector<uint32_t> order;
+  // confidences that passed the threshold scan
+  std::vector<uint32_t> hits;
+  // detections of the image
+  std::vector<bbox> selectedAll;
+  // class lists of the image run through NMS, and those cut to the
+  // pre-NMS top-K
+  uint32_t nms_lists = 0;
+  uint32_t nms_capped_lists = 0;
+  // quantized scores of selectedAll
+  std::vector<uint16_t> selectedKeys;
+  // scratch of the score ordering
+  std::vector<uint32_t> rank_tmp;
+  std::vector<bbox> ranked;
+
+private:
+  // boxes decoded for the image, valid where the stamp matches generation
+  std::vector<float> decoded;
+  std::vector<uint32_t> decoded_stamp;
+  uint32_t generation = 0;
+};
+
 template <typename Loc, typename Conf, typename MParams> class NMS_ABP {
   std::string binPath;
 
@@ -40,15 +137,36 @@ public:
   std::string priorName;
   float *priorTensor;
   MParams modelParams;
-  NMS_ABP(const std::string &path) {
+  float locPositionLUT[256];
+  float locSizeLUT[256];
+  // Candidates per class kept for NMS, 0 keeps all.
+  int preNMSTopK;
+  std::atomic<uint64_t> preNMSLists{0};
+  std::atomic<uint64_t> preNMSCappedLists{0};
+  // Quantized confidences pass the class threshold when their raw value is
+  // above this, see deriveConfThreshold.
+  int confThresholdRaw = 0;
+
+  NMS_ABP(const std::string &path, int pre_nms_top_k = 0) {
     binPath = path;
+    preNMSTopK = pre_nms_top_k;
     if (binPath == "")
       binPath = ".";
     readPriors();
     if (modelParams.PREPROCESS_PRIOR)
       preprocessPrior();
+    if constexpr (LOC_LUT)
+      buildLocLUT();
+    deriveConfThreshold();
   }
-  ~NMS_ABP() { delete priorTensor; };
+  ~NMS_ABP() {
+    delete[] priorTensor;
+    if (preNMSTopK > 0 && preNMSLists) {
+      std::cout << "NMS pre-selection top-" << preNMSTopK << " capped "
+                << preNMSCappedLists << " of " << preNMSLists
+                << " class lists" << std::endl;
+    }
+  };
   void preprocessPrior() {
 
     for (uint32_t i = 0; i < modelParams.TOTAL_NUM_BOXES; i++) {
@@ -65,182 +183,213 @@ public:
       prior[3] = cent_y;
     }
   }
+  // Reads tensorLength floats.
   float *read(std::string priorFilename, uint32_t tensorLength) {
     std::ifstream fs(binPath + "/" + priorFilename, std::ifstream::binary);
     fs.seekg(0, std::ios::end);
     uint32_t fileSize = fs.tellg();
     fs.seekg(0, std::ios::beg);
 
-    if (tensorLength != fileSize) {
+    if (tensorLength * sizeof(float) != fileSize) {
       std::cerr << "Invalid input: " << priorFilename << std::endl;
       std::cerr << "Length mismatch: "
-                << " Tensor Size: " << tensorLength
+                << " Tensor Size: " << tensorLength * sizeof(float)
                 << ",\t File Size: " << fileSize << std::endl;
       std::exit(1);
     }
     float *priorData = new float[tensorLength];
-    fs.read((char *)priorData, tensorLength);
+    fs.read((char *)priorData, tensorLength * sizeof(float));
     fs.close();
     return priorData;
   }
 
 public:
   void readPriors() {
-    priorTensor =
-        read(modelParams.priorName,
-             modelParams.TOTAL_NUM_BOXES * NUM_COORDINATES * sizeof(float));
+    priorTensor = read(modelParams.priorName,
+                       modelParams.TOTAL_NUM_BOXES * NUM_COORDINATES);
   }
 
+  // Leaves the detections of the image in ws.selectedAll, the first
+  // KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE of them ordered by score.
   void anchorBoxProcessing(const Loc *const locTensor,
-                           const Conf *const confTensor,
-                           std::vector<bbox> &selectedAll, const float idx) {
+                           const Conf *const confTensor, NMSWorkspace &ws,
+                           const float idx) {
+
+    ws.selectedAll.clear();
+    ws.selectedKeys.clear();
+    ws.nms_lists = ws.nms_capped_lists = 0;
+
+    // a box passing the threshold for several classes is decoded once
+    ws.beginImage(modelParams.TOTAL_NUM_BOXES);
+
+    if constexpr (MParams::MODEL == NMS_MODEL_R34)
+      processClassMajor(locTensor, confTensor, ws, idx);
+    else
+      processBoxMajor(locTensor, confTensor, ws, idx);
+
+    orderDetections(ws);
+    countPreNMSTopK(ws);
+  }
+
+  // Runs NMS on a class-major confidence tensor (R34), one class at a time.
+  void processClassMajor(const Loc *const locTensor,
+                         const Conf *const confTensor, NMSWorkspace &ws,
+                         const float idx) {
 
     const Conf *confPtr = confTensor;
     const Loc *locPtr = locTensor;
-
     float const *priorPtr = priorTensor;
-#if defined(MODEL_R34)
+    bool fresh;
 
     for (uint32_t ci = modelParams.CLASSES_OFFSET; ci < modelParams.NUM_CLASSES;
          ci++) {
 
       uint32_t confItr = ci * modelParams.OFFSET_CONF;
-      std::vector<bbox> result;
-      std::vector<bbox> selected;
-      confPtr = confTensor;
-      locPtr = locTensor;
-      priorPtr = priorTensor;
-#ifdef __amd64__
-      for (uint32_t bi = 0; bi < modelParams.TOTAL_NUM_BOXES;
-#else
-      for (uint32_t bi = 0; bi < 15130;
-#endif
-           ++bi, confPtr++, locPtr++, priorPtr++) {
+      CandidateBoxes &result = ws.candidates[ci];
+      result.clear();
+
+      int num_hits = scanAboveThreshold(confTensor + confItr,
+                                        modelParams.TOTAL_NUM_BOXES, ws.hits);
+
+      for (int h = 0; h < num_hits; ++h) {
+
+        uint32_t bi = ws.hits[h];
+        confPtr = confTensor + bi;
+        locPtr = locTensor + bi;
+        priorPtr = priorTensor + bi;
 
         Conf confidence = confPtr[confItr];
-        if (confidence < 10854)
-          continue;
         // if (!above_Class_Threshold(confidence)) continue;
+        // hits are scattered over the class plane, a bulk
+        // fp16_to_fp32_array would widen every box, so widen only the hit
         float cf = get_Score_Val(confidence);
-        bbox cBox = {get_Loc_Val(locPtr[modelParams.BOX_ITR_0]),
-                     get_Loc_Val(locPtr[modelParams.BOX_ITR_1]),
-                     get_Loc_Val(locPtr[modelParams.BOX_ITR_2]),
-                     get_Loc_Val(locPtr[modelParams.BOX_ITR_3])};
-        if (modelParams.variance.data() != NULL)
-          cBox =
-              decodeLocationTensor(cBox, priorPtr, modelParams.variance.data());
-        else
-          cBox = decodeLocationTensor(cBox, priorPtr);
-        result.emplace_back(std::initializer_list<float>{
-            idx, cBox[1], cBox[0], cBox[3], cBox[2], cf, (float)ci});
+        float *cBox = ws.decodedBox(bi, fresh);
+        if (fresh)
+          decodeBox(cBox, locPtr, modelParams.BOX_ITR_0, modelParams.BOX_ITR_1,
+                    modelParams.BOX_ITR_2, modelParams.BOX_ITR_3, priorPtr);
+        result.push(cBox[1], cBox[0], cBox[3], cBox[2], cf,
+                    scoreKey(confidence));
       }
 
       if (result.size()) {
-        NMS(result, modelParams.NMS_THRESHOLD, modelParams.MAX_BOXES_PER_CLASS,
-            selected, selectedAll, modelParams.class_map);
+        NMS(ws, result, ci, idx, modelParams.NMS_THRESHOLD,
+            modelParams.MAX_BOXES_PER_CLASS, modelParams.class_map);
       }
     }
-#else // MV1 and RX50
-    std::vector<bbox> result[modelParams.NUM_CLASSES];
-    std::vector<bbox> selected[modelParams.NUM_CLASSES];
-    for (uint32_t bi = 0; bi < modelParams.TOTAL_NUM_BOXES;
-         bi++, locPtr += 4, priorPtr += 4) {
-      uint32_t confItr = bi * modelParams.NUM_CLASSES;
-      for (uint32_t ci = modelParams.CLASSES_OFFSET;
-           ci < modelParams.NUM_CLASSES; ci++) {
-
-        Conf confidence = confPtr[confItr + ci];
-        if (!above_Class_Threshold(confidence))
+  }
+
+  // Runs NMS on a box-major confidence tensor (MV1 and RX50).
+  void processBoxMajor(const Loc *const locTensor,
+                       const Conf *const confTensor, NMSWorkspace &ws,
+                       const float idx) {
+
+    const Conf *confPtr = confTensor;
+    const Loc *locPtr = locTensor;
+    float const *priorPtr = priorTensor;
+    bool fresh;
+
+    for (uint32_t ci = modelParams.CLASSES_OFFSET; ci < modelParams.NUM_CLASSES;
+         ci++)
+      ws.candidates[ci].clear();
+
+    // scan the box-major confidences a chunk of boxes at a time, hits come
+    // out in (box, class) order
+    for (uint32_t chunk = 0; chunk < modelParams.TOTAL_NUM_BOXES;
+         chunk += NMS_SCAN_CHUNK_BOXES) {
+      uint32_t chunk_boxes =
+          std::min<uint32_t>(NMS_SCAN_CHUNK_BOXES,
+                             modelParams.TOTAL_NUM_BOXES - chunk);
+      int num_hits = scanAboveThreshold(
+          confTensor + chunk * modelParams.NUM_CLASSES,
+          chunk_boxes * modelParams.NUM_CLASSES, ws.hits);
+
+      for (int h = 0; h < num_hits; ++h) {
+
+        uint32_t bi = chunk + ws.hits[h] / modelParams.NUM_CLASSES;
+        uint32_t ci = ws.hits[h] % modelParams.NUM_CLASSES;
+        if (ci < modelParams.CLASSES_OFFSET)
           continue;
+        locPtr = locTensor + bi * 4;
+        priorPtr = priorTensor + bi * 4;
+
+        Conf confidence = confPtr[bi * modelParams.NUM_CLASSES + ci];
+        // one class of the box row passed, widening the row with
+        // fp16_to_fp32_array would convert NUM_CLASSES values for it
         float cf = get_Score_Val(confidence);
-        bbox cBox = {get_Loc_Val(locPtr[0]), get_Loc_Val(locPtr[1]),
-                     get_Loc_Val(locPtr[2]), get_Loc_Val(locPtr[3])};
-        if (modelParams.variance.data() != NULL)
-          cBox =
-              decodeLocationTensor(cBox, priorPtr, modelParams.variance.data());
-        else
-          cBox = decodeLocationTensor(cBox, priorPtr);
-        result[ci].emplace_back(std::initializer_list<float>{
-            idx, cBox[1], cBox[0], cBox[3], cBox[2], cf, (float)ci});
+        float *cBox = ws.decodedBox(bi, fresh);
+        if (fresh)
+          decodeBox(cBox, locPtr, 0, 1, 2, 3, priorPtr);
+        ws.candidates[ci].push(cBox[1], cBox[0], cBox[3], cBox[2], cf,
+                               scoreKey(confidence));
       }
     }
 
     for (uint32_t ci = modelParams.CLASSES_OFFSET; ci < modelParams.NUM_CLASSES;
          ci++) {
-      if (result[ci].size()) {
-        NMS(result[ci], modelParams.NMS_THRESHOLD,
-            modelParams.MAX_BOXES_PER_CLASS, selected[ci], selectedAll,
-            modelParams.class_map);
+      if (ws.candidates[ci].size()) {
+        NMS(ws, ws.candidates[ci], ci, idx, modelParams.NMS_THRESHOLD,
+            modelParams.MAX_BOXES_PER_CLASS, modelParams.class_map);
       }
     }
-#endif
-    int middle = selectedAll.size();
-    if (middle > modelParams.KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE) {
-      middle = modelParams.KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE;
-    }
-    std::partial_sort(selectedAll.begin(), selectedAll.begin() + middle,
-                      selectedAll.end(), [](const bbox &a, const bbox &b) {
-                        return a[SCORE_POSITION] > b[SCORE_POSITION];
-                      });
   }
 
-#if defined(MODEL_RX50)
+  // RX50 with top-K outputs: per output level, the best boxes with their
+  // class in topkTensor.
   void anchorBoxProcessing(const Loc **const locTensor,
                            const Conf **const confTensor,
                            const uint64_t **const topkTensor,
-                           std::vector<bbox> &selectedAll, const float idx) {
+                           NMSWorkspace &ws, const float idx) {
+    static_assert(MParams::MODEL == NMS_MODEL_RX50,
+                  "top-K outputs are produced by RX50 only");
+
+    std::vector<bbox> &selectedAll = ws.selectedAll;
+    selectedAll.clear();
+    ws.selectedKeys.clear();
+    ws.nms_lists = ws.nms_capped_lists = 0;
 
-    std::vector<bbox> result[modelParams.NUM_CLASSES];
-    std::vector<bbox> selected[modelParams.NUM_CLASSES];
+    for (uint32_t ci = modelParams.CLASSES_OFFSET; ci < modelParams.NUM_CLASSES;
+         ci++)
+      ws.candidates[ci].clear();
 
     uint32_t prior_offset = 0;
 
     for (uint32_t gi = 0; gi < modelParams.OUTPUT_LEVELS; ++gi) {
       prior_offset += modelParams.OUTPUT_DELTAS[gi];
 
-      const Loc *locPtr = locTensor[gi];
+      int num_hits = scanAboveThreshold(
+          confTensor[gi], modelParams.OUTPUT_BOXES_PER_LEVEL, ws.hits);
 
-      for (uint32_t bi = 0; bi < modelParams.OUTPUT_BOXES_PER_LEVEL;
-           ++bi, locPtr += 4) {
+      for (int h = 0; h < num_hits; ++h) {
 
-        bbox cBox = {get_Loc_Val(locPtr[0]), get_Loc_Val(locPtr[1]),
-                     get_Loc_Val(locPtr[2]), get_Loc_Val(locPtr[3])};
+        uint32_t bi = ws.hits[h];
+        const Loc *locPtr = locTensor[gi] + bi * 4;
 
         uint32_t cls = (uint32_t)topkTensor[gi][bi] % modelParams.NUM_CLASSES;
         uint32_t off = prior_offset +
                        (uint32_t)topkTensor[gi][bi] / modelParams.NUM_CLASSES;
-        float cf = get_Score_Val(confTensor[gi][bi]);
-        if (!above_Class_Threshold(cf))
-          continue;
+        Conf confidence = confTensor[gi][bi];
+        // the level is contiguous but mostly below the threshold, the
+        // few that pass are cheaper to widen singly than the whole level
+        float cf = get_Score_Val(confidence);
 
-        if (modelParams.variance.data() != NULL)
-          cBox = decodeLocationTensor(cBox, &priorTensor[off * 4],
-                                      modelParams.variance.data());
-        else
-          cBox = decodeLocationTensor(cBox, &priorTensor[off * 4]);
+        float cBox[NUM_COORDINATES];
+        decodeBox(cBox, locPtr, 0, 1, 2, 3, &priorTensor[off * 4]);
 
-        result[cls].emplace_back(std::initializer_list<float>{
-            idx, cBox[1], cBox[0], cBox[3], cBox[2], cf, (float)cls});
+        ws.candidates[cls].push(cBox[1], cBox[0], cBox[3], cBox[2], cf,
+                                scoreKey(confidence));
       }
     }
 
     for (uint32_t ci = modelParams.CLASSES_OFFSET; ci < modelParams.NUM_CLASSES;
          ci++) {
-      if (result[ci].size()) {
-        NMS(result[ci], modelParams.NMS_THRESHOLD,
-            modelParams.MAX_BOXES_PER_CLASS, selected[ci], selectedAll,
-            modelParams.class_map);
+      if (ws.candidates[ci].size()) {
+        NMS(ws, ws.candidates[ci], ci, idx, modelParams.NMS_THRESHOLD,
+            modelParams.MAX_BOXES_PER_CLASS, modelParams.class_map);
       }
     }
 
-    int middle = selectedAll.size();
-    if (middle > modelParams.KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE) {
-      middle = modelParams.KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE;
-    }
-    std::partial_sort(selectedAll.begin(), selectedAll.begin() + middle,
-                      selectedAll.end(), [](const bbox &a, const bbox &b) {
-                        return a[SCORE_POSITION] > b[SCORE_POSITION];
-                      });
+    orderDetections(ws);
+    countPreNMSTopK(ws);
 
     for (uint32_t b = 0; b < selectedAll.size(); ++b) {
       postproc(selectedAll[b][1]);
@@ -249,7 +398,56 @@ public:
       postproc(selectedAll[b][4]);
     }
   }
-#endif
+
+  // Sets the class threshold in the raw domain of Conf so that quantized
+  // confidences are compared without converting them. Unless the model
+  // gives it, it is derived: scores grow with the raw value (8-bit scales
+  // are positive, and half precision bit patterns read as int16 order the
+  // non-negative values), so the threshold is the largest raw value whose
+  // score does not pass.
+  void deriveConfThreshold() {
+    if constexpr (std::is_integral<Conf>::value) {
+      confThresholdRaw = std::is_same<Conf, uint16_t>::value
+                             ? MParams::CLASS_THRESHOLD_FP16
+                             : MParams::CLASS_THRESHOLD_UINT8;
+      if (confThresholdRaw != CLASS_THRESHOLD_DERIVE)
+        return;
+
+      int lo, hi;
+      if constexpr (std::is_same<Conf, uint16_t>::value) {
+        static_assert(MParams::CLASS_THRESHOLD >= 0.0f,
+                      "half precision thresholds must not be negative");
+        lo = 0;
+        hi = 0x7c00; // +inf
+        confThresholdRaw = std::numeric_limits<int16_t>::max();
+      } else {
+        lo = std::numeric_limits<Conf>::min();
+        hi = std::numeric_limits<Conf>::max();
+        confThresholdRaw = hi;
+      }
+      for (int x = lo; x <= hi; ++x) {
+        if (get_Score_Val(Conf(x)) > modelParams.CLASS_THRESHOLD) {
+          confThresholdRaw = x - 1;
+          break;
+        }
+      }
+    }
+  }
+
+  // Threshold scan, equivalent to testing every confidence with
+  // above_Class_Threshold(confidence). hits is grown to fit n indices.
+  int scanAboveThreshold(const Conf *conf, int n,
+                         std::vector<uint32_t> &hits) {
+    if (hits.size() < n)
+      hits.resize(n);
+    if constexpr (std::is_same<Conf, uint16_t>::value)
+      return scan_threshold_raw(conf, n, confThresholdRaw, hits.data());
+    else if constexpr (std::is_same<Conf, float>::value)
+      return scan_threshold(conf, n, modelParams.CLASS_THRESHOLD,
+                            hits.data());
+    else
+      return scan_threshold(conf, n, confThresholdRaw, hits.data());
+  }
 
   inline void postproc(float &box) {
     box /= modelParams.BOX_SCALE;
@@ -259,17 +457,16 @@ public:
       box = 1.0f;
   }
 
-  inline Conf above_Class_Threshold(uint8_t score) {
-    return score > modelParams.CLASS_THRESHOLD_UINT8;
+  inline bool above_Class_Threshold(uint8_t score) {
+    return score > confThresholdRaw;
   }
-  inline Conf above_Class_Threshold(int8_t score) {
-    return score > modelParams.CLASS_THRESHOLD_UINT8;
+  inline bool above_Class_Threshold(int8_t score) {
+    return score > confThresholdRaw;
   }
-  inline Conf above_Class_Threshold(uint16_t score) {
-    //      return score > modelParams.CLASS_THRESHOLD_FP16;
-    return fp16_ieee_to_fp32_value(score) > modelParams.CLASS_THRESHOLD;
+  inline bool above_Class_Threshold(uint16_t score) {
+    return int16_t(score) > confThresholdRaw;
   }
-  inline Conf above_Class_Threshold(float score) {
+  inline bool above_Class_Threshold(float score) {
     return score > modelParams.CLASS_THRESHOLD;
   }
   inline float get_Loc_Val(uint8_t x) {
@@ -290,139 +487,245 @@ public:
                              modelParams.CONF_SCALE);
   }
   inline float get_Score_Val(float x) { return x; }
-  bbox decodeLocationTensor(const bbox &loc, const float *const prior,
-                            const float *const var) {
-
-    float x = prior[modelParams.BOX_ITR_0] +
-              loc[0] * var[0] * prior[modelParams.BOX_ITR_2];
-    float y = prior[modelParams.BOX_ITR_1] +
-              loc[1] * var[0] * prior[modelParams.BOX_ITR_3];
-    float w = prior[modelParams.BOX_ITR_2] * expf(loc[2] * var[1]);
-    float h = prior[modelParams.BOX_ITR_3] * expf(loc[3] * var[1]);
+
+  // Quantized scores order candidates by their raw value. The scores that
+  // pass the class threshold are positive, so half precision bit patterns
+  // compare like the values; int8 is offset to compare as unsigned.
+  static constexpr bool KEYED_SCORES = std::is_integral<Conf>::value;
+  inline uint16_t scoreKey(uint16_t x) { return x; }
+  inline uint16_t scoreKey(uint8_t x) { return x; }
+  inline uint16_t scoreKey(int8_t x) { return (uint8_t)x ^ 0x80; }
+  inline uint16_t scoreKey(float x) { return 0; }
+
+  // A location is decoded from a position term of its first two values and
+  // a size term of the last two, see decodeLocationTensor.
+  float positionTerm(float loc) {
+    if constexpr (MParams::HAS_VARIANCE)
+      return loc * MParams::variance[0];
+    else if constexpr (MParams::MODEL == NMS_MODEL_RX50)
+      return loc;
+    else
+      return loc / 10.0f;
+  }
+
+  float sizeTerm(float loc) {
+    if constexpr (MParams::HAS_VARIANCE)
+      return expf(loc * MParams::variance[1]);
+    else if constexpr (MParams::MODEL == NMS_MODEL_RX50)
+      return expf(loc);
+    else
+      return expf(loc / 5.0f);
+  }
+
+  // 8-bit locations take 256 values, so their terms are tabulated up front
+  // and decoding them needs no dequantization or expf.
+  static constexpr bool LOC_LUT =
+      std::is_integral<Loc>::value && sizeof(Loc) == 1;
+
+  void buildLocLUT() {
+    for (int q = 0; q < 256; ++q) {
+      float loc = get_Loc_Val(static_cast<Loc>(q));
+      locPositionLUT[q] = positionTerm(loc);
+      locSizeLUT[q] = sizeTerm(loc);
+    }
+  }
+
+  // Decodes the location at locPtr[i0..i3] against prior into
+  // {x1, y1, x2, y2}.
+  void decodeBox(float *box, const Loc *locPtr, int i0, int i1, int i2,
+                 int i3, const float *const prior) {
+    float t0, t1, e2, e3;
+    if constexpr (LOC_LUT) {
+      t0 = locPositionLUT[uint8_t(locPtr[i0])];
+      t1 = locPositionLUT[uint8_t(locPtr[i1])];
+      e2 = locSizeLUT[uint8_t(locPtr[i2])];
+      e3 = locSizeLUT[uint8_t(locPtr[i3])];
+    } else {
+      // four values, strided for coordinate major tensors and shorter
+      // than one fp16_to_fp32_array vector, so they go one at a time
+      t0 = positionTerm(get_Loc_Val(locPtr[i0]));
+      t1 = positionTerm(get_Loc_Val(locPtr[i1]));
+      e2 = sizeTerm(get_Loc_Val(locPtr[i2]));
+      e3 = sizeTerm(get_Loc_Val(locPtr[i3]));
+    }
+    if constexpr (MParams::HAS_VARIANCE)
+      decodeLocationTensorVariance(box, t0, t1, e2, e3, prior);
+    else if constexpr (MParams::MODEL == NMS_MODEL_RX50)
+      decodeLocationTensorCentered(box, t0, t1, e2, e3, prior);
+    else
+      decodeLocationTensor(box, t0, t1, e2, e3, prior);
+  }
+
+  void decodeLocationTensorVariance(float *box, float t0, float t1, float e2,
+                                    float e3, const float *const prior) {
+
+    float x = prior[modelParams.BOX_ITR_0] + t0 * prior[modelParams.BOX_ITR_2];
+    float y = prior[modelParams.BOX_ITR_1] + t1 * prior[modelParams.BOX_ITR_3];
+    float w = prior[modelParams.BOX_ITR_2] * e2;
+    float h = prior[modelParams.BOX_ITR_3] * e3;
     x -= (w / 2.0f);
     y -= (h / 2.0f);
     w += x;
     h += y;
 
-    return {x, y, w, h};
+    box[0] = x;
+    box[1] = y;
+    box[2] = w;
+    box[3] = h;
   }
 
-#if defined(MODEL_RX50)
-  bbox decodeLocationTensor(const bbox &loc, const float *const prior) {
+  // RX50 priors are preprocessed to {w, h, cent_x, cent_y}.
+  void decodeLocationTensorCentered(float *box, float t0, float t1, float e2,
+                                    float e3, const float *const prior) {
 
     float w = prior[0];
     float h = prior[1];
     float cent_x = prior[2];
     float cent_y = prior[3];
 
-    float dx = loc[0];
-    float dy = loc[1];
-    float dw = loc[2];
-    float dh = loc[3];
+    float pred_cent_x = t0 * w + cent_x;
+    float pred_cent_y = t1 * h + cent_y;
+    float pred_w = e2 * w;
+    float pred_h = e3 * h;
 
-    float pred_cent_x = dx * w + cent_x;
-    float pred_cent_y = dy * h + cent_y;
-    float pred_w = expf(dw) * w;
-    float pred_h = expf(dh) * h;
-
-    return {(pred_cent_x - 0.5f * pred_w), (pred_cent_y - 0.5f * pred_h),
-            (pred_cent_x + 0.5f * pred_w), (pred_cent_y + 0.5f * pred_h)};
+    box[0] = pred_cent_x - 0.5f * pred_w;
+    box[1] = pred_cent_y - 0.5f * pred_h;
+    box[2] = pred_cent_x + 0.5f * pred_w;
+    box[3] = pred_cent_y + 0.5f * pred_h;
   }
-#else
-  bbox decodeLocationTensor(const bbox &loc, const float *const prior) {
+
+  void decodeLocationTensor(float *box, float t0, float t1, float e2,
+                            float e3, const float *const prior) {
 
     float w = prior[3] - prior[1];
     float h = prior[2] - prior[0];
     float cent_x = prior[1] + 0.5f * w;
     float cent_y = prior[0] + 0.5f * h;
 
-    float dy = loc[0] / 10.0f;
-    float dx = loc[1] / 10.0f;
-    float dh = loc[2] / 5.0f;
-    float dw = loc[3] / 5.0f;
+    // the location is stored as {dy, dx, dh, dw}
+    float pred_cent_x = t1 * w + cent_x;
+    float pred_cent_y = t0 * h + cent_y;
+    float pred_w = e3 * w;
+    float pred_h = e2 * h;
 
-    float pred_cent_x = dx * w + cent_x;
-    float pred_cent_y = dy * h + cent_y;
-    float pred_w = expf(dw) * w;
-    float pred_h = expf(dh) * h;
+    box[0] = pred_cent_x - 0.5f * pred_w;
+    box[1] = pred_cent_y - 0.5f * pred_h;
+    box[2] = pred_cent_x + 0.5f * pred_w;
+    box[3] = pred_cent_y + 0.5f * pred_h;
+  }
 
-    return {pred_cent_x - 0.5f * pred_w, pred_cent_y - 0.5f * pred_h,
-            pred_cent_x + 0.5f * pred_w, pred_cent_y + 0.5f * pred_h};
+  void insertSelected(NMSWorkspace &ws, const CandidateBoxes &boxes, int c,
+                      const float cls, const float idx) {
+    ws.selected.push(boxes.y1[c], boxes.x1[c], boxes.y2[c], boxes.x2[c],
+                     boxes.score[c], boxes.key[c]);
+    ws.selectedAll.push_back({{idx, boxes.y1[c], boxes.x1[c], boxes.y2[c],
+                               boxes.x2[c], boxes.score[c], cls}});
+    ws.selectedKeys.push_back(boxes.key[c]);
   }
-#endif
 
-  template <typename A, typename B>
-  void pack(const std::vector<A> &part1, const std::vector<B> &part2,
-            std::vector<std::pair<A, B>> &packed) {
-    assert(part1.size() == part2.size());
-    for (size_t i = 0; i < part1.size(); i++) {
-      packed.push_back(std::make_pair(part1[i], part2[i]));
+  void countPreNMSTopK(const NMSWorkspace &ws) {
+    if (preNMSTopK > 0) {
+      preNMSLists += ws.nms_lists;
+      preNMSCappedLists += ws.nms_capped_lists;
     }
   }
 
-  template <typename A, typename B>
-  void unpack(const std::vector<std::pair<A, B>> &packed, std::vector<A> &part1,
-              std::vector<B> &part2) {
-    for (size_t i = 0; i < part1.size(); i++) {
-      part1[i] = packed[i].first;
-      part2[i] = packed[i].second;
+  // Orders ws.selectedAll by descending score, at least its first
+  // KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE entries. Quantized scores are
+  // ranked in linear time and then order the whole list, equal scores
+  // keeping their detection order.
+  void orderDetections(NMSWorkspace &ws) {
+    std::vector<bbox> &selectedAll = ws.selectedAll;
+    if constexpr (KEYED_SCORES) {
+      rank_by_key(ws.selectedKeys.data(), selectedAll.size(), ws.order,
+                  ws.rank_tmp);
+      ws.ranked.resize(selectedAll.size());
+      for (uint32_t r = 0; r < selectedAll.size(); ++r)
+        ws.ranked[r] = selectedAll[ws.order[r]];
+      selectedAll.swap(ws.ranked);
+    } else {
+      int middle = selectedAll.size();
+      if (middle > modelParams.KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE) {
+        middle = modelParams.KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE;
+      }
+      std::partial_sort(selectedAll.begin(), selectedAll.begin() + middle,
+                        selectedAll.end(), [](const bbox &a, const bbox &b) {
+                          return a[SCORE_POSITION] > b[SCORE_POSITION];
+                        });
     }
   }
-#define AREA(y1, x1, y2, x2) ((y2 - y1) * (x2 - x1))
-  float computeIOU(const float *box1, const float *box2) {
-    float box1_y1 = box1[1], box1_x1 = box1[2], box1_y2 = box1[3],
-          box1_x2 = box1[4];
-    float box2_y1 = box2[1], box2_x1 = box2[2], box2_y2 = box2[3],
-          box2_x2 = box2[4];
-
-    assert(box1_y1 < box1_y2 && box1_x1 < box1_x2);
-    assert(box2_y1 < box2_y2 && box2_x1 < box2_x2);
-
-    float inter_y1 = std::max(box1_y1, box2_y1);
-    float inter_x1 = std::max(box1_x1, box2_x1);
-    float inter_y2 = std::min(box1_y2, box2_y2);
-    float inter_x2 = std::min(box1_x2, box2_x2);
-
-    float IOU = 0.0f;
-
-    if ((inter_y1 < inter_y2) &&
-        (inter_x1 < inter_x2)) // there is a valid intersection
-    {
-      float intersect = AREA(inter_y1, inter_x1, inter_y2, inter_x2);
-      float total = AREA(box1_y1, box1_x1, box1_y2, box1_x2) +
-                    AREA(box2_y1, box2_x1, box2_y2, box2_x2) - intersect;
-      IOU = total > 0.0f ? (intersect / total) : 0.0f;
+
+  void NMS(NMSWorkspace &ws, const CandidateBoxes &boxes, const uint32_t ci,
+           const float idx, const float &thres, const int &max_output_size,
+           const float *classmap) {
+
+    // only the best preNMSTopK candidates take part when it is set
+    int keep = boxes.size();
+    ws.nms_lists++;
+    if (preNMSTopK > 0 && keep > preNMSTopK) {
+      keep = preNMSTopK;
+      ws.nms_capped_lists++;
     }
-    return IOU;
-  }
 
-  void insertSelected(std::vector<std::vector<float>> &selected,
-                      std::vector<std::vector<float>> &selectedAll,
-                      std::vector<float> &cand, const float &thres,
-                      std::vector<float> &classmap) {
-    for (int i = 0; i < selected.size(); i++) {
-      if (computeIOU(&cand[0], &selected[i][0]) > thres) {
-        return;
+    // ties are broken by candidate index to keep the output deterministic
+    std::vector<uint32_t> &order = ws.order;
+    if constexpr (KEYED_SCORES) {
+      rank_by_key(boxes.key.data(), boxes.size(), order, ws.rank_tmp);
+      order.resize(keep);
+    } else {
+      auto higher = [&](uint32_t a, uint32_t b) {
+        return boxes.score[a] > boxes.score[b] ||
+               (boxes.score[a] == boxes.score[b] && a < b);
+      };
+      order.resize(boxes.size());
+      std::iota(order.begin(), order.end(), 0);
+      if (keep < order.size()) {
+        std::nth_element(order.begin(), order.begin() + keep, order.end(),
+                         higher);
+        order.resize(keep);
       }
+      std::sort(order.begin(), order.end(), higher);
     }
-    cand[SCORE_POSITION] = cand[5];
-    if (modelParams.MAP_CLASSES)
-      cand[CLASS_POSITION] = classmap[cand[CLASS_POSITION]];
-    selected.push_back(cand);
-    selectedAll.push_back(cand);
-  }
-
-  void NMS(std::vector<std::vector<float>> &boxes, const float &thres,
-           const int &max_output_size,
-           std::vector<std::vector<float>> &selected,
-           std::vector<std::vector<float>> &selectedAll,
-           std::vector<float> &classmap) {
-
-    std::sort(std::begin(boxes), std::end(boxes),
-              [&](const auto &a, const auto &b) { return (a[5] > b[5]); });
-    for (int i = 0; (i < boxes.size()) && (selected.size() < max_output_size);
-         i++) {
-      insertSelected(selected, selectedAll, boxes[i], thres, classmap);
+
+    float cls = modelParams.MAP_CLASSES ? classmap[ci] : (float)ci;
+
+    // Candidates are taken in blocks of NMS_IOU_BLOCK. A block is first
+    // tested against the boxes selected before it, then resolved in score
+    // order, each accepted candidate suppressing the rest of the block.
+    CandidateBoxes &selected = ws.selected;
+    selected.clear();
+    IouBlock blk;
+    for (int start = 0;
+         (start < order.size()) && (selected.size() < max_output_size);
+         start += NMS_IOU_BLOCK) {
+      int n = std::min<int>(NMS_IOU_BLOCK, order.size() - start);
+      for (int j = 0; j < NMS_IOU_BLOCK; j++) {
+        if (j < n) {
+          uint32_t c = order[start + j];
+          blk.y1[j] = boxes.y1[c];
+          blk.x1[j] = boxes.x1[c];
+          blk.y2[j] = boxes.y2[c];
+          blk.x2[j] = boxes.x2[c];
+        } else {
+          blk.y1[j] = blk.x1[j] = blk.y2[j] = blk.x2[j] = 0.0f;
+        }
+      }
+
+      uint32_t live = (1u << n) - 1;
+      for (int s = 0; s < selected.size() && live; s++)
+        live &= ~iou_above(blk, selected.y1[s], selected.x1[s],
+                           selected.y2[s], selected.x2[s], thres);
+
+      while (live) {
+        int j = __builtin_ctz(live);
+        live &= live - 1;
+        insertSelected(ws, boxes, order[start + j], cls, idx);
+        if (selected.size() >= max_output_size)
+          return;
+        if (live)
+          live &= ~iou_above(blk, blk.y1[j], blk.x1[j], blk.y2[j],
+                             blk.x2[j], thres);
+      }
     }
   }
 };
@@ -22,45 +22,67 @@
 // SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
 //
 
-#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
 
+// Detection models the NMS plugin supports.
+enum NMSModel { NMS_MODEL_MV1, NMS_MODEL_R34, NMS_MODEL_RX50 };
+
+// Quantized confidences pass the class threshold when their raw value is
+// above CLASS_THRESHOLD_UINT8 (8-bit) or CLASS_THRESHOLD_FP16 (half precision
+// bit pattern). Models that compare converted scores leave these at
+// CLASS_THRESHOLD_DERIVE, the raw threshold is then derived from
+// CLASS_THRESHOLD.
+static constexpr int CLASS_THRESHOLD_DERIVE = INT32_MIN;
+
+// Parameter sets are compile-time traits, so the NMS kernels built for a
+// model see its sizes and thresholds as constants. LocType and ConfType are
+// the output types of the quantized model.
 class R34_Params {
 public:
-  const int NUM_CLASSES = 81;
-  const int MAX_BOXES_PER_CLASS = 100;
-  const int TOTAL_NUM_BOXES = 15130;
-
-  const int DATA_LENGTH_LOC = 60520;
-  const int DATA_LENGTH_CONF = 1225530;
-
-  const int BOX_ITR_0 = 0;
-  const int BOX_ITR_1 = (TOTAL_NUM_BOXES * 1);
-  const int BOX_ITR_2 = (TOTAL_NUM_BOXES * 2);
-  const int BOX_ITR_3 = (TOTAL_NUM_BOXES * 3);
-
-  const int OFFSET_CONF = 15130;
-  const int BOXES_INDEX = 0;
-  const int CLASSES_INDEX = 1;
-
-  const int CLASSES_OFFSET = 1;
-
-  const float LOC_OFFSET = 0.0f;
-  const float LOC_SCALE = 0.134f;
-  const float CONF_OFFSET = 0.0f;
-  const float CONF_SCALE = 1.0f;
-
-  const float CLASS_THRESHOLD = 0.05f;
-  const int CLASS_THRESHOLD_UINT8 = 0; // fixme
-  const int CLASS_THRESHOLD_FP16 = 10854;
-  const float NMS_THRESHOLD = 0.5f;
-  const int KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE = 600;
-  const int KILT_MODEL_NMS_MAX_DETECTIONS_PER_CLASS = 100;
-
-  const char *priorName = "R34_priors.bin";
-  const bool MAP_CLASSES = true;
-  const bool PREPROCESS_PRIOR = false;
-  std::vector<float> variance = {0.1, 0.2};
-  std::vector<float> class_map = {
+  static constexpr NMSModel MODEL = NMS_MODEL_R34;
+  typedef uint8_t LocType;
+  typedef uint16_t ConfType;
+
+  static constexpr int NUM_CLASSES = 81;
+  static constexpr int MAX_BOXES_PER_CLASS = 100;
+  static constexpr int TOTAL_NUM_BOXES = 15130;
+
+  static constexpr int DATA_LENGTH_LOC = 60520;
+  static constexpr int DATA_LENGTH_CONF = 1225530;
+
+  static constexpr int BOX_ITR_0 = 0;
+  static constexpr int BOX_ITR_1 = (TOTAL_NUM_BOXES * 1);
+  static constexpr int BOX_ITR_2 = (TOTAL_NUM_BOXES * 2);
+  static constexpr int BOX_ITR_3 = (TOTAL_NUM_BOXES * 3);
+
+  static constexpr int OFFSET_CONF = 15130;
+  static constexpr int BOXES_INDEX = 0;
+  static constexpr int CLASSES_INDEX = 1;
+
+  static constexpr int CLASSES_OFFSET = 1;
+
+  static constexpr float LOC_OFFSET = 0.0f;
+  static constexpr float LOC_SCALE = 0.134f;
+  static constexpr float CONF_OFFSET = 0.0f;
+  static constexpr float CONF_SCALE = 1.0f;
+
+  static constexpr float CLASS_THRESHOLD = 0.05f;
+  static constexpr int CLASS_THRESHOLD_UINT8 = CLASS_THRESHOLD_DERIVE;
+  // 0.05 rounds to 10854 in half precision, which passes
+  static constexpr int CLASS_THRESHOLD_FP16 = 10853;
+  static constexpr float NMS_THRESHOLD = 0.5f;
+  static constexpr int KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE = 600;
+  static constexpr int KILT_MODEL_NMS_MAX_DETECTIONS_PER_CLASS = 100;
+
+  static constexpr const char *priorName = "R34_priors.bin";
+  static constexpr bool MAP_CLASSES = true;
+  static constexpr bool PREPROCESS_PRIOR = false;
+  static constexpr bool HAS_VARIANCE = true;
+  static constexpr float variance[2] = {0.1f, 0.2f};
+  static constexpr float class_map[81] = {
       0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 13, 14, 15, 16, 17,
       18, 19, 20, 21, 22, 23, 24, 25, 27, 28, 31, 32, 33, 34, 35, 36, 37,
       38, 39, 40, 41, 42, 43, 44, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55,
@@ -70,103 +92,114 @@ public:
 
 class MV1_Params {
 public:
-  const int NUM_CLASSES = 91;
-  const int MAX_BOXES_PER_CLASS = 100;
-  const int TOTAL_NUM_BOXES = 1917;
-
-  const int DATA_LENGTH_LOC = 7668;
-  const int DATA_LENGTH_CONF = 17447;
-
-  const int BOX_ITR_0 = 0;
-  const int BOX_ITR_1 = 1;
-  const int BOX_ITR_2 = 2;
-  const int BOX_ITR_3 = 3;
-
-  const int OFFSET_CONF = 1;
-  const int BOXES_INDEX = 1;
-  const int CLASSES_INDEX = 0;
-
-  const int CLASSES_OFFSET = 1;
-
-  const float LOC_OFFSET = 0.0f;
-  const float LOC_SCALE = 0.144255146f;
-  const float CONF_OFFSET = -128.0f;
-  const float CONF_SCALE = 0.00392156886f;
-
-  const float CLASS_THRESHOLD = 0.3f;
-  const int CLASS_THRESHOLD_UINT8 = 76;
-  const int CLASS_THRESHOLD_FP16 = 0; // fixme
-  const float NMS_THRESHOLD = 0.45f;
-  const int KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE = 100;
-  const int KILT_MODEL_NMS_MAX_DETECTIONS_PER_CLASS = 100;
-
-  const char *priorName = "MV1_priors.bin";
-  const bool MAP_CLASSES = false;
-  const bool PREPROCESS_PRIOR = false;
-  std::vector<float> variance = {};
-  std::vector<float> class_map = {};
+  static constexpr NMSModel MODEL = NMS_MODEL_MV1;
+  typedef uint8_t LocType;
+  typedef uint8_t ConfType;
+
+  static constexpr int NUM_CLASSES = 91;
+  static constexpr int MAX_BOXES_PER_CLASS = 100;
+  static constexpr int TOTAL_NUM_BOXES = 1917;
+
+  static constexpr int DATA_LENGTH_LOC = 7668;
+  static constexpr int DATA_LENGTH_CONF = 17447;
+
+  static constexpr int BOX_ITR_0 = 0;
+  static constexpr int BOX_ITR_1 = 1;
+  static constexpr int BOX_ITR_2 = 2;
+  static constexpr int BOX_ITR_3 = 3;
+
+  static constexpr int OFFSET_CONF = 1;
+  static constexpr int BOXES_INDEX = 1;
+  static constexpr int CLASSES_INDEX = 0;
+
+  static constexpr int CLASSES_OFFSET = 1;
+
+  static constexpr float LOC_OFFSET = 0.0f;
+  static constexpr float LOC_SCALE = 0.144255146f;
+  static constexpr float CONF_OFFSET = -128.0f;
+  static constexpr float CONF_SCALE = 0.00392156886f;
+
+  static constexpr float CLASS_THRESHOLD = 0.3f;
+  static constexpr int CLASS_THRESHOLD_UINT8 = 76;
+  static constexpr int CLASS_THRESHOLD_FP16 = CLASS_THRESHOLD_DERIVE;
+  static constexpr float NMS_THRESHOLD = 0.45f;
+  static constexpr int KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE = 100;
+  static constexpr int KILT_MODEL_NMS_MAX_DETECTIONS_PER_CLASS = 100;
+
+  static constexpr const char *priorName = "MV1_priors.bin";
+  static constexpr bool MAP_CLASSES = false;
+  static constexpr bool PREPROCESS_PRIOR = false;
+  static constexpr bool HAS_VARIANCE = false;
+  static constexpr const float *variance = nullptr;
+  static constexpr const float *class_map = nullptr;
 };
 
 class RX50_Params {
 public:
-  const int NUM_CLASSES = 264;
-  const int MAX_BOXES_PER_CLASS = 200;
-  const int TOTAL_NUM_BOXES = 120087;
+  static constexpr NMSModel MODEL = NMS_MODEL_RX50;
+  typedef uint16_t LocType;
+  typedef uint16_t ConfType;
 
-  const int DATA_LENGTH_LOC = 480348;
-  const int DATA_LENGTH_CONF = 32183316;
+  static constexpr int NUM_CLASSES = 264;
+  static constexpr int MAX_BOXES_PER_CLASS = 200;
+  static constexpr int TOTAL_NUM_BOXES = 120087;
 
-  const int BOX_ITR_0 = 0;
-  const int BOX_ITR_1 = (TOTAL_NUM_BOXES * 1);
-  const int BOX_ITR_2 = (TOTAL_NUM_BOXES * 2);
-  const int BOX_ITR_3 = (TOTAL_NUM_BOXES * 3);
+  static constexpr int DATA_LENGTH_LOC = 480348;
+  static constexpr int DATA_LENGTH_CONF = 32183316;
 
-  const int OFFSET_CONF = 120087;
+  static constexpr int BOX_ITR_0 = 0;
+  static constexpr int BOX_ITR_1 = (TOTAL_NUM_BOXES * 1);
+  static constexpr int BOX_ITR_2 = (TOTAL_NUM_BOXES * 2);
+  static constexpr int BOX_ITR_3 = (TOTAL_NUM_BOXES * 3);
+
+  static constexpr int OFFSET_CONF = 120087;
 
 #ifdef SDK_1_11_X
-  const int CLASSES_INDEX = 5;
-  const int BOXES_INDEX = 10;
-  const int TOPK_INDEX = 0;
+  static constexpr int CLASSES_INDEX = 5;
+  static constexpr int BOXES_INDEX = 10;
+  static constexpr int TOPK_INDEX = 0;
 #else
-  const int CLASSES_INDEX = 0;
-  const int BOXES_INDEX = 5;
-  const int TOPK_INDEX = 10;
+  static constexpr int CLASSES_INDEX = 0;
+  static constexpr int BOXES_INDEX = 5;
+  static constexpr int TOPK_INDEX = 10;
 #endif
 
-  const int CLASSES_OFFSET = 0;
+  static constexpr int CLASSES_OFFSET = 0;
 
-  const int OUTPUT_LEVELS = 5;
-  const int OUTPUT_BOXES_PER_LEVEL = 1000;
-  const int OUTPUT_DELTAS[5] = {0, 90000, 22500, 5625, 1521};
+  static constexpr int OUTPUT_LEVELS = 5;
+  static constexpr int OUTPUT_BOXES_PER_LEVEL = 1000;
+  static constexpr int OUTPUT_DELTAS[5] = {0, 90000, 22500, 5625, 1521};
 
 #ifndef LOC_OFFSET
-  const float LOC_OFFSET = 25.0f;
+  static constexpr float LOC_OFFSET = 25.0f;
 #endif
 #ifndef LOC_SCALE
-  const float LOC_SCALE = 0.01684683f;
+  static constexpr float LOC_SCALE = 0.01684683f;
 #endif
 #ifndef CONF_OFFSET
-  const float CONF_OFFSET = -128.0f;
+  static constexpr float CONF_OFFSET = -128.0f;
 #endif
 #ifndef CONF_SCALE
-  const float CONF_SCALE = 0.00388179976f;
+  static constexpr float CONF_SCALE = 0.00388179976f;
 #endif
 
-  const float CLASS_THRESHOLD = 0.05f;
-  const int CLASS_THRESHOLD_UINT8 = 5;
-  const int CLASS_THRESHOLD_FP16 = 10854;
-  const float NMS_THRESHOLD = 0.5f;
-  const int KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE = 1000;
-  const int KILT_MODEL_NMS_MAX_DETECTIONS_PER_CLASS = 1000;
+  static constexpr float CLASS_THRESHOLD = 0.05f;
+  // scores pass above 0.05, raw 12 for uint8 and 10854 for half precision
+  static constexpr int CLASS_THRESHOLD_UINT8 = CLASS_THRESHOLD_DERIVE;
+  static constexpr int CLASS_THRESHOLD_FP16 = CLASS_THRESHOLD_DERIVE;
+  static constexpr float NMS_THRESHOLD = 0.5f;
+  static constexpr int KILT_MODEL_NMS_MAX_DETECTIONS_PER_IMAGE = 1000;
+  static constexpr int KILT_MODEL_NMS_MAX_DETECTIONS_PER_CLASS = 1000;
 
   //   const float BOX_SCALE = 0.00125f;
-  const float BOX_SCALE = 800.0f;
+  static constexpr float BOX_SCALE = 800.0f;
 
-  const char *priorName = "retinanet_priors.bin";
-  const bool MAP_CLASSES = false;
-  const bool PREPROCESS_PRIOR = true;
-  std::vector<float> variance = {};
-  std::vector<float> class_map = {};
+  static constexpr const char *priorName = "retinanet_priors.bin";
+  static constexpr bool MAP_CLASSES = false;
+  static constexpr bool PREPROCESS_PRIOR = true;
+  static constexpr bool HAS_VARIANCE = false;
+  static constexpr const float *variance = nullptr;
+  static constexpr const float *class_map = nullptr;
 };
 
 #define CONVERT_TO_INT8(x) ((int8_t)((int16_t)x - 128))
@@ -178,4 +211,46 @@ public:
 
 #define CONVERT_INT8_FP32(x, offset, scale) ((x - offset) * scale)
 
-using bbox = std::vector<float>;
+// A detection as reported to loadgen:
+// {image index, y1, x1, y2, x2, score, class}.
+struct bbox {
+  float v[7];
+
+  float &operator[](int i) { return v[i]; }
+  const float &operator[](int i) const { return v[i]; }
+};
+
+static_assert(sizeof(bbox) == 7 * sizeof(float),
+              "bbox must match the loadgen detection layout");
+
+// Whether the priors of MParams are in directory dir: the file is named
+// after the model and holds TOTAL_NUM_BOXES boxes of 4 floats.
+template <typename MParams> inline bool hasPriors(const std::string &dir) {
+  struct stat st;
+  std::string path = (dir == "" ? std::string(".") : dir) + "/" +
+                     MParams::priorName;
+  return stat(path.c_str(), &st) == 0 &&
+         st.st_size == MParams::TOTAL_NUM_BOXES * 4 * sizeof(float);
+}
+
+// Selects the model by name (MV1, R34 or RX50). Without a name the model is
+// the one whose priors are in prior_dir, and failing that fallback.
+inline NMSModel selectNMSModel(const std::string &name,
+                               const std::string &prior_dir,
+                               NMSModel fallback) {
+  if (name == "MV1")
+    return NMS_MODEL_MV1;
+  if (name == "R34")
+    return NMS_MODEL_R34;
+  if (name == "RX50")
+    return NMS_MODEL_RX50;
+  if (name != "")
+    throw "Unknown NMS model " + name;
+  if (hasPriors<R34_Params>(prior_dir))
+    return NMS_MODEL_R34;
+  if (hasPriors<RX50_Params>(prior_dir))
+    return NMS_MODEL_RX50;
+  if (hasPriors<MV1_Params>(prior_dir))
+    return NMS_MODEL_MV1;
+  return fallback;
+}
@@ -0,0 +1,89 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SCORE_ORDER_H
+#define SCORE_ORDER_H
+
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Writes to order the indices 0..n-1 ranked by descending key, equal keys in
+// ascending index order. Keys are raw quantized scores, so this is a stable
+// counting sort on each key byte and costs O(n) whatever the scores are. A
+// byte that is the same for every key is skipped, which leaves a single pass
+// for 8-bit keys.
+static inline void rank_by_key(const uint16_t *keys, uint32_t n,
+                               std::vector<uint32_t> &order,
+                               std::vector<uint32_t> &tmp) {
+  uint32_t lo[256] = {0};
+  uint32_t hi[256] = {0};
+
+  // digits of the complemented key rank higher keys first
+  for (uint32_t i = 0; i < n; ++i) {
+    uint16_t d = ~keys[i];
+    lo[d & 0xff]++;
+    hi[d >> 8]++;
+  }
+
+  bool sort_lo = n && lo[(uint16_t)~keys[0] & 0xff] != n;
+  bool sort_hi = n && hi[(uint16_t)~keys[0] >> 8] != n;
+
+  uint32_t lo_start = 0, hi_start = 0;
+  for (int b = 0; b < 256; ++b) {
+    uint32_t c = lo[b];
+    lo[b] = lo_start;
+    lo_start += c;
+    c = hi[b];
+    hi[b] = hi_start;
+    hi_start += c;
+  }
+
+  order.resize(n);
+  if (!sort_hi) {
+    if (!sort_lo) {
+      std::iota(order.begin(), order.end(), 0);
+      return;
+    }
+    for (uint32_t i = 0; i < n; ++i)
+      order[lo[(uint16_t)~keys[i] & 0xff]++] = i;
+    return;
+  }
+
+  if (!sort_lo) {
+    for (uint32_t i = 0; i < n; ++i)
+      order[hi[(uint16_t)~keys[i] >> 8]++] = i;
+    return;
+  }
+
+  tmp.resize(n);
+  for (uint32_t i = 0; i < n; ++i)
+    tmp[lo[(uint16_t)~keys[i] & 0xff]++] = i;
+  for (uint32_t j = 0; j < n; ++j) {
+    uint32_t i = tmp[j];
+    order[hi[(uint16_t)~keys[i] >> 8]++] = i;
+  }
+}
+
+#endif // SCORE_ORDER_H
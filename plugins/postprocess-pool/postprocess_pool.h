@@ -0,0 +1,104 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef POSTPROCESS_POOL_H
+#define POSTPROCESS_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A unit of postprocessing work: run(ctx, item).
+struct PostprocessTask {
+  void (*run)(void *ctx, int item);
+  void *ctx;
+  int item;
+};
+
+// Worker threads that take postprocessing off the threads delivering device
+// results. There is one worker per cpu in the affinity list, each pinned to
+// its cpu. Tasks run in submission order across the workers.
+class PostprocessPool {
+public:
+  PostprocessPool(const std::vector<int> &affinities) {
+    std::cout << "Postprocess threads:";
+    for (size_t a = 0; a < affinities.size(); ++a) {
+      workers.push_back(std::thread(&PostprocessPool::worker, this));
+
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(affinities[a], &cpu_set);
+      pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpu_set_t),
+                             &cpu_set);
+      std::cout << " " << affinities[a];
+    }
+    std::cout << std::endl;
+  }
+
+  // Runs the tasks already submitted, then stops the workers.
+  ~PostprocessPool() {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      terminate = true;
+    }
+    cv.notify_all();
+    for (size_t w = 0; w < workers.size(); ++w)
+      workers[w].join();
+  }
+
+  void submit(void (*run)(void *ctx, int item), void *ctx, int item) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      tasks.push_back({run, ctx, item});
+    }
+    cv.notify_one();
+  }
+
+private:
+  void worker() {
+    while (true) {
+      PostprocessTask t;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return terminate || !tasks.empty(); });
+        if (tasks.empty())
+          return;
+        t = tasks.front();
+        tasks.pop_front();
+      }
+      t.run(t.ctx, t.item);
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<PostprocessTask> tasks;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool terminate = false;
+};
+
+#endif // POSTPROCESS_POOL_H
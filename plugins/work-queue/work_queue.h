@@ -0,0 +1,160 @@
+//
+// MIT License
+//
+// Copyright (c) 2021 - 2023 Krai Ltd
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+#define WORK_QUEUE_CACHE_LINE 64
+
+// Bounded lock-free multi-producer multi-consumer queue (after D. Vyukov).
+// Each slot carries a sequence number telling producers and consumers
+// whose turn it is, so neither side ever takes a lock; head and tail live on
+// their own cache lines. Elements are moved in and out, never copied.
+template <typename T> class MPMCQueue {
+public:
+  MPMCQueue(size_t capacity) {
+    this->capacity = capacity;
+    cells = new Cell[capacity];
+    for (size_t i = 0; i < capacity; ++i)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  ~MPMCQueue() { delete[] cells; }
+
+  // Moves v in, unless the queue is full: then returns false and leaves v
+  // alone.
+  bool push(T &&v) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &c = cells[pos % capacity];
+      size_t seq = c.seq.load(std::memory_order_acquire);
+      intptr_t dif = intptr_t(seq) - intptr_t(pos);
+      if (dif == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    Cell &c = cells[pos % capacity];
+    c.data = std::move(v);
+    c.seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool push(const T &v) {
+    T tmp = v;
+    return push(std::move(tmp));
+  }
+
+  // Moves the oldest element to v, unless the queue is empty: then returns
+  // false.
+  bool pop(T &v) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &c = cells[pos % capacity];
+      size_t seq = c.seq.load(std::memory_order_acquire);
+      intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+      if (dif == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    Cell &c = cells[pos % capacity];
+    v = std::move(c.data);
+    c.seq.store(pos + capacity, std::memory_order_release);
+    return true;
+  }
+
+  // Number of queued elements, only a snapshot while others push or pop.
+  size_t size() const {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  alignas(WORK_QUEUE_CACHE_LINE) std::atomic<size_t> head;
+  alignas(WORK_QUEUE_CACHE_LINE) std::atomic<size_t> tail;
+  alignas(WORK_QUEUE_CACHE_LINE) Cell *cells;
+  size_t capacity;
+};
+
+// Lets a thread sleep on a futex until another signals that there may be
+// work for it. A waiter reads epoch() before looking for work and passes it
+// to wait(), so a notify() in between makes wait() return at once rather
+// than being missed.
+class WakeSignal {
+public:
+  uint32_t epoch() const { return seq.load(std::memory_order_seq_cst); }
+
+  void wait(uint32_t e) {
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    if (seq.load(std::memory_order_seq_cst) == e)
+      syscall(SYS_futex, word(), FUTEX_WAIT_PRIVATE, e, nullptr, nullptr, 0);
+    waiters.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  void notify() {
+    seq.fetch_add(1, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst))
+      syscall(SYS_futex, word(), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+              nullptr, 0);
+  }
+
+private:
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "futex needs a plain 32-bit word");
+
+  uint32_t *word() { return reinterpret_cast<uint32_t *>(&seq); }
+
+  alignas(WORK_QUEUE_CACHE_LINE) std::atomic<uint32_t> seq{0};
+  alignas(WORK_QUEUE_CACHE_LINE) std::atomic<int> waiters{0};
+};
+
+#endif // WORK_QUEUE_H